@@ -1,4 +1,5 @@
 #include "filesys/fat.h"
+#include <bitmap.h>
 #include "devices/disk.h"
 #include "filesys/filesys.h"
 #include "threads/malloc.h"
@@ -9,7 +10,7 @@
 /* Should be less than DISK_SECTOR_SIZE */
 struct fat_boot {
 	unsigned int magic;
-	unsigned int sectors_per_cluster; /* Fixed to 1 */
+	unsigned int sectors_per_cluster;
 	unsigned int total_sectors;
 	unsigned int fat_start;
 	unsigned int fat_sectors; /* Size of FAT in sectors. */
@@ -24,12 +25,21 @@ struct fat_fs {
 	disk_sector_t data_start;
 	cluster_t last_clst;
 	struct lock write_lock;
+	cluster_t *free_list;     /* Free clusters, lowest on top. */
+	unsigned int free_cnt;    /* Number of clusters in FREE_LIST. */
+	struct bitmap *dirty;     /* FAT sectors changed since last written. */
 };
 
+/* FAT entries per FAT sector. */
+#define ENTRIES_PER_SECTOR (DISK_SECTOR_SIZE / sizeof (cluster_t))
+
 static struct fat_fs *fat_fs;
 
+unsigned int fat_format_cluster = SECTORS_PER_CLUSTER;
+
 void fat_boot_create (void);
 void fat_fs_init (void);
+static void fat_index (void);
 
 void
 fat_init (void) {
@@ -78,6 +88,7 @@ fat_open (void) {
 			free (bounce);
 		}
 	}
+	fat_index ();
 }
 
 void
@@ -90,27 +101,37 @@ fat_close (void) {
 	disk_write (filesys_disk, FAT_BOOT_SECTOR, bounce);
 	free (bounce);
 
-	// Write FAT directly to the disk
+	// Write the FAT sectors that changed directly to the disk
 	uint8_t *buffer = (uint8_t *) fat_fs->fat;
 	off_t bytes_wrote = 0;
 	off_t bytes_left = sizeof (fat_fs->fat);
 	const off_t fat_size_in_bytes = fat_fs->fat_length * sizeof (cluster_t);
-	for (unsigned i = 0; i < fat_fs->bs.fat_sectors; i++) {
+	size_t i = 0;
+	while ((i = bitmap_scan (fat_fs->dirty, i, 1, true)) != BITMAP_ERROR) {
+		bytes_wrote = i * DISK_SECTOR_SIZE;
 		bytes_left = fat_size_in_bytes - bytes_wrote;
 		if (bytes_left >= DISK_SECTOR_SIZE) {
 			disk_write (filesys_disk, fat_fs->bs.fat_start + i,
 			            buffer + bytes_wrote);
-			bytes_wrote += DISK_SECTOR_SIZE;
 		} else {
 			bounce = calloc (1, DISK_SECTOR_SIZE);
 			if (bounce == NULL)
 				PANIC ("FAT close failed");
-			memcpy (bounce, buffer + bytes_wrote, bytes_left);
+			if (bytes_left > 0)
+				memcpy (bounce, buffer + bytes_wrote, bytes_left);
 			disk_write (filesys_disk, fat_fs->bs.fat_start + i, bounce);
-			bytes_wrote += bytes_left;
 			free (bounce);
 		}
+		bitmap_reset (fat_fs->dirty, i++);
 	}
+
+	// Release the in-memory FAT until the next fat_open()
+	free (fat_fs->fat);
+	free (fat_fs->free_list);
+	bitmap_destroy (fat_fs->dirty);
+	fat_fs->fat = NULL;
+	fat_fs->free_list = NULL;
+	fat_fs->dirty = NULL;
 }
 
 void
@@ -123,6 +144,10 @@ fat_create (void) {
 	fat_fs->fat = calloc (fat_fs->fat_length, sizeof (cluster_t));
 	if (fat_fs->fat == NULL)
 		PANIC ("FAT creation failed");
+	fat_index ();
+
+	// A new FAT has to be written out whole
+	bitmap_set_all (fat_fs->dirty, true);
 
 	// Set up ROOT_DIR_CLST
 	fat_put (ROOT_DIR_CLUSTER, EOChain);
@@ -131,7 +156,9 @@ fat_create (void) {
 	uint8_t *buf = calloc (1, DISK_SECTOR_SIZE);
 	if (buf == NULL)
 		PANIC ("FAT create failed due to OOM");
-	disk_write (filesys_disk, cluster_to_sector (ROOT_DIR_CLUSTER), buf);
+	for (unsigned i = 0; i < fat_fs->bs.sectors_per_cluster; i++)
+		disk_write (filesys_disk, cluster_to_sector (ROOT_DIR_CLUSTER) + i,
+		            buf);
 	free (buf);
 }
 
@@ -139,10 +166,10 @@ void
 fat_boot_create (void) {
 	unsigned int fat_sectors =
 	    (disk_size (filesys_disk) - 1)
-	    / (DISK_SECTOR_SIZE / sizeof (cluster_t) * SECTORS_PER_CLUSTER + 1) + 1;
+	    / (DISK_SECTOR_SIZE / sizeof (cluster_t) * fat_format_cluster + 1) + 1;
 	fat_fs->bs = (struct fat_boot){
 	    .magic = FAT_MAGIC,
-	    .sectors_per_cluster = SECTORS_PER_CLUSTER,
+	    .sectors_per_cluster = fat_format_cluster,
 	    .total_sectors = disk_size (filesys_disk),
 	    .fat_start = 1,
 	    .fat_sectors = fat_sectors,
@@ -152,42 +179,124 @@ fat_boot_create (void) {
 
 void
 fat_fs_init (void) {
-	/* TODO: Your code goes here. */
+	unsigned int clusters;
+
+	fat_fs->data_start = fat_fs->bs.fat_start + fat_fs->bs.fat_sectors;
+
+	/* Entry 0 stands for "no cluster", so cluster N is entry N and
+	 * the table has one entry more than there are data clusters. */
+	clusters = (fat_fs->bs.total_sectors - fat_fs->data_start)
+		/ fat_fs->bs.sectors_per_cluster;
+	fat_fs->fat_length = clusters + 1;
+	if (fat_fs->fat_length > fat_fs->bs.fat_sectors * ENTRIES_PER_SECTOR)
+		fat_fs->fat_length = fat_fs->bs.fat_sectors * ENTRIES_PER_SECTOR;
+	fat_fs->last_clst = fat_fs->fat_length - 1;
+	lock_init (&fat_fs->write_lock);
+}
+
+/* Builds the free cluster list from the FAT just loaded or created,
+ * so that allocation never has to scan the FAT, and starts with no
+ * FAT sector dirty. */
+static void
+fat_index (void) {
+	cluster_t clst;
+
+	fat_fs->free_list = malloc (fat_fs->fat_length * sizeof (cluster_t));
+	fat_fs->dirty = bitmap_create (fat_fs->bs.fat_sectors);
+	if (fat_fs->free_list == NULL || fat_fs->dirty == NULL)
+		PANIC ("FAT index creation failed");
+
+	/* Pushed from the top down, so the lowest cluster comes off first
+	 * and new files are laid out in ascending order. */
+	fat_fs->free_cnt = 0;
+	for (clst = fat_fs->last_clst; clst > ROOT_DIR_CLUSTER; clst--)
+		if (fat_fs->fat[clst] == 0)
+			fat_fs->free_list[fat_fs->free_cnt++] = clst;
 }
 
 /*----------------------------------------------------------------------------*/
 /* FAT handling                                                               */
 /*----------------------------------------------------------------------------*/
 
+/* Sets the FAT entry for CLST to VAL and marks its FAT sector
+ * dirty.  The caller must hold the write lock. */
+static void
+set_entry (cluster_t clst, cluster_t val) {
+	ASSERT (clst > 0 && clst < fat_fs->fat_length);
+	fat_fs->fat[clst] = val;
+	bitmap_mark (fat_fs->dirty, clst / ENTRIES_PER_SECTOR);
+}
+
 /* Add a cluster to the chain.
  * If CLST is 0, start a new chain.
  * Returns 0 if fails to allocate a new cluster. */
 cluster_t
 fat_create_chain (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	cluster_t new_clst = 0;
+
+	lock_acquire (&fat_fs->write_lock);
+	if (fat_fs->free_cnt > 0) {
+		new_clst = fat_fs->free_list[--fat_fs->free_cnt];
+		if (clst != 0) {
+			set_entry (new_clst, fat_fs->fat[clst]);
+			set_entry (clst, new_clst);
+		} else
+			set_entry (new_clst, EOChain);
+	}
+	lock_release (&fat_fs->write_lock);
+	return new_clst;
 }
 
 /* Remove the chain of clusters starting from CLST.
  * If PCLST is 0, assume CLST as the start of the chain. */
 void
 fat_remove_chain (cluster_t clst, cluster_t pclst) {
-	/* TODO: Your code goes here. */
+	lock_acquire (&fat_fs->write_lock);
+	if (pclst != 0)
+		set_entry (pclst, EOChain);
+	while (clst != 0 && clst != EOChain) {
+		cluster_t next = fat_fs->fat[clst];
+		set_entry (clst, 0);
+		fat_fs->free_list[fat_fs->free_cnt++] = clst;
+		clst = next;
+	}
+	lock_release (&fat_fs->write_lock);
 }
 
 /* Update a value in the FAT table. */
 void
 fat_put (cluster_t clst, cluster_t val) {
-	/* TODO: Your code goes here. */
+	lock_acquire (&fat_fs->write_lock);
+	set_entry (clst, val);
+	lock_release (&fat_fs->write_lock);
 }
 
 /* Fetch a value in the FAT table. */
 cluster_t
 fat_get (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	ASSERT (clst > 0 && clst < fat_fs->fat_length);
+	return fat_fs->fat[clst];
 }
 
 /* Covert a cluster # to a sector number. */
 disk_sector_t
 cluster_to_sector (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	ASSERT (clst > 0);
+	return fat_fs->data_start
+		+ (clst - 1) * fat_fs->bs.sectors_per_cluster;
+}
+
+/* Returns the number of sectors in a cluster, as recorded in the
+ * boot sector when the disk was formatted. */
+unsigned int
+fat_sectors_per_cluster (void) {
+	return fat_fs->bs.sectors_per_cluster;
+}
+
+/* Converts the first sector of a cluster back to the cluster #. */
+cluster_t
+sector_to_cluster (disk_sector_t sector) {
+	ASSERT (sector >= fat_fs->data_start);
+	return (sector - fat_fs->data_start) / fat_fs->bs.sectors_per_cluster
+		+ 1;
 }
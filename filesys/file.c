@@ -1,29 +1,45 @@
 #include "filesys/file.h"
 #include <debug.h>
 #include "filesys/inode.h"
-#include "threads/malloc.h"
+#include "devices/disk.h"
+#include "threads/slab.h"
+
+/* How far ahead of a sequential reader to read. */
+#define READAHEAD_BYTES (8 * DISK_SECTOR_SIZE)
 
 /* An open file. */
 struct file {
 	struct inode *inode;        /* File's inode. */
 	off_t pos;                  /* Current position. */
 	bool deny_write;            /* Has file_deny_write() been called? */
+	off_t ra_next;              /* Where a sequential read would start. */
+	off_t ra_end;               /* End of the bytes read ahead. */
 };
 
+/* Open file objects. */
+static struct slab_cache file_slab;
+
+/* Initializes the open file allocator. */
+void
+file_init (void) {
+	slab_cache_init (&file_slab, "file", sizeof (struct file));
+}
+
 /* Opens a file for the given INODE, of which it takes ownership,
  * and returns the new file.  Returns a null pointer if an
  * allocation fails or if INODE is null. */
 struct file *
 file_open (struct inode *inode) {
-	struct file *file = calloc (1, sizeof *file);
+	struct file *file = slab_alloc (&file_slab);
 	if (inode != NULL && file != NULL) {
 		file->inode = inode;
 		file->pos = 0;
 		file->deny_write = false;
+		file->ra_next = file->ra_end = 0;
 		return file;
 	} else {
 		inode_close (inode);
-		free (file);
+		slab_free (&file_slab, file);
 		return NULL;
 	}
 }
@@ -54,7 +70,7 @@ file_close (struct file *file) {
 	if (file != NULL) {
 		file_allow_write (file);
 		inode_close (file->inode);
-		free (file);
+		slab_free (&file_slab, file);
 	}
 }
 
@@ -64,6 +80,28 @@ file_get_inode (struct file *file) {
 	return file->inode;
 }
 
+/* Notes that the bytes of FILE from OFS up to END were just read.  If
+ * they follow on from the previous read, the reader is going through
+ * the file in order, so keeps the next READAHEAD_BYTES on their way
+ * into the page cache, asking for more once half of them are used. */
+static void
+file_readahead (struct file *file, off_t ofs, off_t end) {
+	bool sequential = ofs == file->ra_next;
+
+	file->ra_next = end;
+	if (!sequential || end == ofs) {
+		file->ra_end = end;
+		return;
+	}
+	if (file->ra_end < end)
+		file->ra_end = end;
+	if (file->ra_end - end < READAHEAD_BYTES / 2) {
+		inode_readahead (file->inode, file->ra_end,
+				end + READAHEAD_BYTES - file->ra_end);
+		file->ra_end = end + READAHEAD_BYTES;
+	}
+}
+
 /* Reads SIZE bytes from FILE into BUFFER,
  * starting at the file's current position.
  * Returns the number of bytes actually read,
@@ -72,6 +110,7 @@ file_get_inode (struct file *file) {
 off_t
 file_read (struct file *file, void *buffer, off_t size) {
 	off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+	file_readahead (file, file->pos, file->pos + bytes_read);
 	file->pos += bytes_read;
 	return bytes_read;
 }
@@ -83,15 +122,16 @@ file_read (struct file *file, void *buffer, off_t size) {
  * The file's current position is unaffected. */
 off_t
 file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs) {
-	return inode_read_at (file->inode, buffer, size, file_ofs);
+	off_t bytes_read = inode_read_at (file->inode, buffer, size, file_ofs);
+	file_readahead (file, file_ofs, file_ofs + bytes_read);
+	return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
  * starting at the file's current position.
  * Returns the number of bytes actually written,
- * which may be less than SIZE if end of file is reached.
- * (Normally we'd grow the file in that case, but file growth is
- * not yet implemented.)
+ * which may be less than SIZE if the disk fills up.
+ * Writing past the end of FILE grows it.
  * Advances FILE's position by the number of bytes read. */
 off_t
 file_write (struct file *file, const void *buffer, off_t size) {
@@ -103,9 +143,8 @@ file_write (struct file *file, const void *buffer, off_t size) {
 /* Writes SIZE bytes from BUFFER into FILE,
  * starting at offset FILE_OFS in the file.
  * Returns the number of bytes actually written,
- * which may be less than SIZE if end of file is reached.
- * (Normally we'd grow the file in that case, but file growth is
- * not yet implemented.)
+ * which may be less than SIZE if the disk fills up.
+ * Writing past the end of FILE grows it.
  * The file's current position is unaffected. */
 off_t
 file_write_at (struct file *file, const void *buffer, off_t size,
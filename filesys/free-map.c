@@ -1,63 +1,210 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Sectors covered by one entry of the free run index. */
+#define GROUP_SECTORS 512
+
+/* Sectors whose bits share one sector of the free map file. */
+#define MAP_SECTOR_BITS (DISK_SECTOR_SIZE * 8)
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per disk sector. */
+static struct lock free_map_lock;    /* Guards the maps and the index. */
+
+/* Free run index: the number of free sectors in each group of
+ * GROUP_SECTORS, so that scans skip over full groups without
+ * looking at their bits. */
+static uint16_t *group_free;
+static size_t group_cnt;
+
+/* Sectors of the free map file that are out of date, one bit each.
+ * Allocation only marks them, and free_map_sync() writes them. */
+static struct bitmap *dirty_map;
+static struct lock sync_lock;        /* Serializes free_map_sync(). */
+
+/* Where free_map_allocate() starts looking next. */
+static disk_sector_t next_fit;
+
+/* Marks the CNT sectors starting at SECTOR used if USED is true or
+ * free otherwise, keeping the index and the dirty map in step.
+ * The caller must hold free_map_lock. */
+static void
+update (disk_sector_t sector, size_t cnt, bool used) {
+	size_t end = sector + cnt;
+	size_t i, next;
+
+	ASSERT (cnt > 0);
+	bitmap_set_multiple (free_map, sector, cnt, used);
+	for (i = sector; i < end; i = next) {
+		next = ROUND_DOWN (i, GROUP_SECTORS) + GROUP_SECTORS;
+		if (next > end)
+			next = end;
+		if (used)
+			group_free[i / GROUP_SECTORS] -= next - i;
+		else
+			group_free[i / GROUP_SECTORS] += next - i;
+	}
+	bitmap_set_multiple (dirty_map, sector / MAP_SECTOR_BITS,
+			(end - 1) / MAP_SECTOR_BITS - sector / MAP_SECTOR_BITS + 1, true);
+}
+
+/* Counts the free sectors in each group from the free map. */
+static void
+index_groups (void) {
+	size_t sector_cnt = bitmap_size (free_map);
+	size_t i;
+
+	for (i = 0; i < group_cnt; i++) {
+		size_t start = i * GROUP_SECTORS;
+		size_t cnt = sector_cnt - start < GROUP_SECTORS
+			? sector_cnt - start : GROUP_SECTORS;
+		group_free[i] = bitmap_count (free_map, start, cnt, false);
+	}
+}
+
+/* Returns the first of CNT consecutive free sectors at or after
+ * START, or BITMAP_ERROR if there are none.
+ * The caller must hold free_map_lock. */
+static size_t
+find_run (size_t start, size_t cnt) {
+	size_t group = start / GROUP_SECTORS;
+
+	while (group < group_cnt && group_free[group] == 0)
+		group++;
+	if (group >= group_cnt)
+		return BITMAP_ERROR;
+	if (start < group * GROUP_SECTORS)
+		start = group * GROUP_SECTORS;
+	if (start >= bitmap_size (free_map))
+		return BITMAP_ERROR;
+	return bitmap_scan (free_map, start, cnt, false);
+}
 
 /* Initializes the free map. */
 void
 free_map_init (void) {
-	free_map = bitmap_create (disk_size (filesys_disk));
-	if (free_map == NULL)
+	size_t sector_cnt = disk_size (filesys_disk);
+
+	free_map = bitmap_create (sector_cnt);
+	group_cnt = DIV_ROUND_UP (sector_cnt, GROUP_SECTORS);
+	group_free = malloc (group_cnt * sizeof *group_free);
+	dirty_map = bitmap_create (DIV_ROUND_UP (sector_cnt, MAP_SECTOR_BITS));
+	if (free_map == NULL || group_free == NULL || dirty_map == NULL)
 		PANIC ("bitmap creation failed--disk is too large");
-	bitmap_mark (free_map, FREE_MAP_SECTOR);
-	bitmap_mark (free_map, ROOT_DIR_SECTOR);
+	lock_init (&free_map_lock);
+	lock_init (&sync_lock);
+	index_groups ();
+	update (FREE_MAP_SECTOR, 1, true);
+	update (ROOT_DIR_SECTOR, 1, true);
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
- * the first into *SECTORP.
- * Returns true if successful, false if all sectors were
- * available. */
+ * the first into *SECTORP.  Looks at or after NEAR first, so that
+ * sectors of one file end up close together, then from the start
+ * of the disk.
+ * Returns true if successful, false if not enough consecutive
+ * sectors were available.
+ *
+ * The free map file is not written here; see free_map_sync(). */
 bool
-free_map_allocate (size_t cnt, disk_sector_t *sectorp) {
-	disk_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-	if (sector != BITMAP_ERROR
-			&& free_map_file != NULL
-			&& !bitmap_write (free_map, free_map_file)) {
-		bitmap_set_multiple (free_map, sector, cnt, false);
-		sector = BITMAP_ERROR;
-	}
-	if (sector != BITMAP_ERROR)
+free_map_allocate_near (disk_sector_t near, size_t cnt,
+		disk_sector_t *sectorp) {
+	size_t sector;
+
+	lock_acquire (&free_map_lock);
+	sector = find_run (near, cnt);
+	if (sector == BITMAP_ERROR && near != 0)
+		sector = find_run (0, cnt);
+	if (sector != BITMAP_ERROR) {
+		update (sector, cnt, true);
 		*sectorp = sector;
+	}
+	lock_release (&free_map_lock);
 	return sector != BITMAP_ERROR;
 }
 
+/* Allocates CNT consecutive sectors from the free map and stores
+ * the first into *SECTORP, looking after the last sectors this
+ * function allocated.
+ * Returns true if successful, false if not enough consecutive
+ * sectors were available. */
+bool
+free_map_allocate (size_t cnt, disk_sector_t *sectorp) {
+	if (!free_map_allocate_near (next_fit, cnt, sectorp))
+		return false;
+	next_fit = *sectorp + cnt;
+	return true;
+}
+
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (disk_sector_t sector, size_t cnt) {
+	lock_acquire (&free_map_lock);
 	ASSERT (bitmap_all (free_map, sector, cnt));
-	bitmap_set_multiple (free_map, sector, cnt, false);
-	bitmap_write (free_map, free_map_file);
+	update (sector, cnt, false);
+	lock_release (&free_map_lock);
 }
 
-/* Opens the free map file and reads it from disk. */
+/* Writes the sectors of the free map file whose bits changed since
+ * they were last written.  Called periodically by the page cache's
+ * flusher as well as on close, so the map on disk stays about as
+ * fresh as the data it describes.
+ * The file is written without holding free_map_lock, because the
+ * write itself may allocate.  Each sector is marked clean before
+ * it is copied out, so a change that races with the copy marks it
+ * dirty again and gets written on the next pass. */
 void
-free_map_open (void) {
-	free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
+free_map_sync (void) {
+	size_t idx;
+
+	/* Never opened, as when the FAT manages the disk. */
 	if (free_map_file == NULL)
+		return;
+
+	lock_acquire (&sync_lock);
+	while (free_map_file != NULL) {
+		lock_acquire (&free_map_lock);
+		idx = bitmap_scan_and_flip (dirty_map, 0, 1, true);
+		lock_release (&free_map_lock);
+		if (idx == BITMAP_ERROR)
+			break;
+		if (!bitmap_write_range (free_map, free_map_file,
+					idx * DISK_SECTOR_SIZE, DISK_SECTOR_SIZE))
+			PANIC ("can't write free map");
+	}
+	lock_release (&sync_lock);
+}
+
+/* Opens the free map file and reads it from disk.  The file is only
+ * published once the map is read, so that free_map_sync() never
+ * writes out the map as it was before. */
+void
+free_map_open (void) {
+	struct file *file = file_open (inode_open (FREE_MAP_SECTOR));
+	if (file == NULL)
 		PANIC ("can't open free map");
-	if (!bitmap_read (free_map, free_map_file))
+	if (!bitmap_read (free_map, file))
 		PANIC ("can't read free map");
+	index_groups ();
+	bitmap_set_all (dirty_map, false);
+	free_map_file = file;
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) {
+	free_map_sync ();
+	lock_acquire (&sync_lock);
 	file_close (free_map_file);
+	free_map_file = NULL;
+	lock_release (&sync_lock);
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -68,10 +215,12 @@ free_map_create (void) {
 	if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
 		PANIC ("free map creation failed");
 
-	/* Write bitmap to file. */
+	/* Write bitmap to file.  The file's own sectors are allocated
+	 * while it is written, which marks their part of it dirty, so
+	 * free_map_sync() goes around again to record them. */
 	free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
 	if (free_map_file == NULL)
 		PANIC ("can't open free map");
-	if (!bitmap_write (free_map, free_map_file))
-		PANIC ("can't write free map");
+	bitmap_set_all (dirty_map, true);
+	free_map_sync ();
 }
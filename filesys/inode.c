@@ -5,26 +5,57 @@
 #include <string.h>
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/page_cache.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+#ifndef EFILESYS
+/* Sector pointers held directly in the on-disk inode, and held by
+ * each index sector. */
+#define DIRECT_CNT 124
+#define PTRS_PER_SECTOR (DISK_SECTOR_SIZE / sizeof (disk_sector_t))
+
+/* Sectors reachable through the indirect and doubly indirect
+ * blocks, and the most a file can have in all. */
+#define INDIRECT_CNT PTRS_PER_SECTOR
+#define DOUBLY_CNT (PTRS_PER_SECTOR * PTRS_PER_SECTOR)
+#define MAX_SECTORS (DIRECT_CNT + INDIRECT_CNT + DOUBLY_CNT)
+
+/* On-disk inode.
+ * Must be exactly DISK_SECTOR_SIZE bytes long.
+ *
+ * A pointer of 0 stands for a sector that has never been written:
+ * sector 0 holds the free map inode, so it is never file data.
+ * Such holes read as zeros and get a sector on their first write,
+ * so a file only takes up the sectors it has actually written. */
+struct inode_disk {
+	off_t length;                       /* File size in bytes. */
+	unsigned magic;                     /* Magic number. */
+	disk_sector_t direct[DIRECT_CNT];   /* First data sectors. */
+	disk_sector_t indirect;             /* Index of the next ones. */
+	disk_sector_t doubly_indirect;      /* Index of indexes of the rest. */
+};
+#else /* EFILESYS */
 /* On-disk inode.
- * Must be exactly DISK_SECTOR_SIZE bytes long. */
+ * Must be exactly DISK_SECTOR_SIZE bytes long.
+ *
+ * The data is the FAT chain that starts at cluster START.  Clusters
+ * are only added to the chain when the file is written, so the chain
+ * may end short of LENGTH, and the rest reads as zeros. */
 struct inode_disk {
-	disk_sector_t start;                /* First data sector. */
+	cluster_t start;                    /* First data cluster, or 0. */
 	off_t length;                       /* File size in bytes. */
 	unsigned magic;                     /* Magic number. */
 	uint32_t unused[125];               /* Not used. */
 };
 
-/* Returns the number of sectors to allocate for an inode SIZE
- * bytes long. */
-static inline size_t
-bytes_to_sectors (off_t size) {
-	return DIV_ROUND_UP (size, DISK_SECTOR_SIZE);
-}
+/* Distance between the chain positions an inode remembers. */
+#define CKPT_STRIDE 16
+#endif /* EFILESYS */
 
 /* In-memory inode. */
 struct inode {
@@ -33,37 +64,276 @@ struct inode {
 	int open_cnt;                       /* Number of openers. */
 	bool removed;                       /* True if deleted, false otherwise. */
 	int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+	struct lock lock;                   /* Guards the index and length. */
+#ifndef EFILESYS
+	size_t group;                       /* Last doubly indirect group used. */
+	disk_sector_t group_block;          /* Index sector for GROUP, or 0. */
+	disk_sector_t alloc_hint;           /* Where to look for free sectors. */
+#else
+	size_t last_idx;                    /* Chain position of LAST_CLST. */
+	cluster_t last_clst;                /* Last cluster looked up, or 0. */
+	cluster_t *ckpts;                   /* Cluster at each CKPT_STRIDE. */
+	size_t ckpt_cnt;                    /* Number of CKPTS known. */
+	size_t ckpt_cap;                    /* Number of CKPTS allocated. */
+#endif
 	struct inode_disk data;             /* Inode content. */
 };
 
+#ifndef EFILESYS
+/* Allocates a sector for INODE, as close after the last one as
+ * possible, and fills it with zeros in the page cache.
+ * Returns the sector, or 0 if the disk is full. */
+static disk_sector_t
+alloc_zeroed (struct inode *inode) {
+	static char zeros[DISK_SECTOR_SIZE];
+	disk_sector_t sector;
+
+	if (!free_map_allocate_near (inode->alloc_hint, 1, &sector))
+		return 0;
+	inode->alloc_hint = sector + 1;
+	page_cache_write (sector, zeros, 0, DISK_SECTOR_SIZE);
+	return sector;
+}
+
+/* Returns the sector in *SLOT, one of INODE's own pointers.  If it is
+ * empty and CREATE is true, allocates a sector for it first and
+ * writes INODE back. */
+static disk_sector_t
+inode_slot (struct inode *inode, disk_sector_t *slot, bool create) {
+	if (*slot == 0 && create) {
+		*slot = alloc_zeroed (inode);
+		if (*slot != 0)
+			page_cache_write (inode->sector, &inode->data, 0,
+					DISK_SECTOR_SIZE);
+	}
+	return *slot;
+}
+
+/* Returns pointer IDX of INODE's index sector BLOCK.  If it is empty
+ * and CREATE is true, allocates a sector for it first. */
+static disk_sector_t
+index_slot (struct inode *inode, disk_sector_t block, size_t idx,
+		bool create) {
+	disk_sector_t sector;
+
+	page_cache_read (block, &sector, idx * sizeof sector, sizeof sector);
+	if (sector == 0 && create) {
+		sector = alloc_zeroed (inode);
+		if (sector != 0)
+			page_cache_write (block, &sector, idx * sizeof sector,
+					sizeof sector);
+	}
+	return sector;
+}
+
+/* Returns the disk sector that contains byte offset POS within
+ * INODE, or 0 if that part of INODE is a hole.  If CREATE is true,
+ * fills the hole with a zeroed sector first; 0 then means that the
+ * disk is full or that POS is past the largest possible file.
+ *
+ * Consecutive lookups in the doubly indirect range mostly fall in
+ * the same group of PTRS_PER_SECTOR sectors, so INODE remembers the
+ * index sector of the last group, and only its pointer has to be
+ * read again. */
+static disk_sector_t
+byte_to_sector (struct inode *inode, off_t pos, bool create) {
+	struct inode_disk *data = &inode->data;
+	size_t idx = pos / DISK_SECTOR_SIZE;
+	disk_sector_t sector = 0;
+	size_t group;
+
+	ASSERT (inode != NULL);
+	ASSERT (pos >= 0);
+
+	lock_acquire (&inode->lock);
+	if (idx < DIRECT_CNT)
+		sector = inode_slot (inode, &data->direct[idx], create);
+	else if ((idx -= DIRECT_CNT) < INDIRECT_CNT) {
+		if (inode_slot (inode, &data->indirect, create) != 0)
+			sector = index_slot (inode, data->indirect, idx, create);
+	} else if ((idx -= INDIRECT_CNT) < DOUBLY_CNT) {
+		group = idx / PTRS_PER_SECTOR;
+		if (inode->group_block == 0 || inode->group != group) {
+			inode->group_block = 0;
+			if (inode_slot (inode, &data->doubly_indirect, create) != 0) {
+				inode->group = group;
+				inode->group_block = index_slot (inode, data->doubly_indirect,
+						group, create);
+			}
+		}
+		if (inode->group_block != 0)
+			sector = index_slot (inode, inode->group_block,
+					idx % PTRS_PER_SECTOR, create);
+	}
+	lock_release (&inode->lock);
+	return sector;
+}
+
+/* Releases the sectors that index sector BLOCK points to, going
+ * DEPTH more levels of index down, and then BLOCK itself. */
+static void
+release_index (disk_sector_t block, int depth) {
+	disk_sector_t ptrs[PTRS_PER_SECTOR];
+	size_t i;
+
+	if (block == 0)
+		return;
+	page_cache_read (block, ptrs, 0, DISK_SECTOR_SIZE);
+	for (i = 0; i < PTRS_PER_SECTOR; i++)
+		if (ptrs[i] != 0) {
+			if (depth > 0)
+				release_index (ptrs[i], depth - 1);
+			else
+				free_map_release (ptrs[i], 1);
+		}
+	free_map_release (block, 1);
+}
+
+/* Releases the sectors of removed INODE, including its own. */
+static void
+release_sectors (struct inode *inode) {
+	struct inode_disk *data = &inode->data;
+	size_t i;
+
+	for (i = 0; i < DIRECT_CNT; i++)
+		if (data->direct[i] != 0)
+			free_map_release (data->direct[i], 1);
+	release_index (data->indirect, 0);
+	release_index (data->doubly_indirect, 1);
+	free_map_release (inode->sector, 1);
+}
+#else /* EFILESYS */
+/* Adds a cluster to INODE's chain after CLST, or starts the chain if
+ * CLST is 0, and fills it with zeros in the page cache.
+ * Returns the new cluster, or 0 if the disk is full. */
+static cluster_t
+extend_chain (struct inode *inode, cluster_t clst) {
+	static char zeros[DISK_SECTOR_SIZE];
+	cluster_t new_clst = fat_create_chain (clst);
+	disk_sector_t sector;
+	unsigned i;
+
+	if (new_clst == 0)
+		return 0;
+	sector = cluster_to_sector (new_clst);
+	for (i = 0; i < fat_sectors_per_cluster (); i++)
+		page_cache_write (sector + i, zeros, 0, DISK_SECTOR_SIZE);
+	if (clst == 0) {
+		inode->data.start = new_clst;
+		page_cache_write (inode->sector, &inode->data, 0, DISK_SECTOR_SIZE);
+	}
+	return new_clst;
+}
+
+/* Notes that CLST is cluster IDX of INODE's chain: as the last one
+ * looked up, and as the next checkpoint if IDX is the next multiple
+ * of CKPT_STRIDE.  Checkpoints are only ever appended, since chains
+ * only grow at the end while an inode is open. */
+static void
+remember (struct inode *inode, size_t idx, cluster_t clst) {
+	inode->last_idx = idx;
+	inode->last_clst = clst;
+	if (idx % CKPT_STRIDE == 0 && idx / CKPT_STRIDE == inode->ckpt_cnt + 1) {
+		if (inode->ckpt_cnt == inode->ckpt_cap) {
+			size_t cap = inode->ckpt_cap > 0 ? inode->ckpt_cap * 2 : 8;
+			cluster_t *ckpts = realloc (inode->ckpts, cap * sizeof *ckpts);
+			if (ckpts == NULL)
+				return;
+			inode->ckpts = ckpts;
+			inode->ckpt_cap = cap;
+		}
+		inode->ckpts[inode->ckpt_cnt++] = clst;
+	}
+}
+
+/* Returns the cluster of INODE's chain to walk from to reach cluster
+ * CLST_IDX, and stores its position into *IDXP.  That is the last
+ * cluster looked up if it lies on the way, or else the closest
+ * checkpoint before CLST_IDX, so a walk takes fewer than CKPT_STRIDE
+ * steps through the part of the chain seen before.
+ * Returns 0 if the chain is empty. */
+static cluster_t
+chain_start (struct inode *inode, size_t clst_idx, size_t *idxp) {
+	size_t k = clst_idx / CKPT_STRIDE;
+	cluster_t clst;
+
+	if (k > inode->ckpt_cnt)
+		k = inode->ckpt_cnt;
+	*idxp = k * CKPT_STRIDE;
+	clst = k > 0 ? inode->ckpts[k - 1] : inode->data.start;
+	if (inode->last_clst != 0 && inode->last_idx <= clst_idx
+			&& inode->last_idx > *idxp) {
+		*idxp = inode->last_idx;
+		clst = inode->last_clst;
+	}
+	return clst;
+}
+
 /* Returns the disk sector that contains byte offset POS within
- * INODE.
- * Returns -1 if INODE does not contain data for a byte at offset
- * POS. */
+ * INODE, or 0 if INODE's chain ends before POS.  If CREATE is true,
+ * extends the chain up to POS first; 0 then means that the disk is
+ * full. */
 static disk_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) {
+byte_to_sector (struct inode *inode, off_t pos, bool create) {
+	size_t idx = pos / DISK_SECTOR_SIZE;
+	size_t clst_idx = idx / fat_sectors_per_cluster ();
+	disk_sector_t sector = 0;
+	cluster_t clst;
+	size_t i;
+
 	ASSERT (inode != NULL);
-	if (pos < inode->data.length)
-		return inode->data.start + pos / DISK_SECTOR_SIZE;
-	else
-		return -1;
+	ASSERT (pos >= 0);
+
+	lock_acquire (&inode->lock);
+	if (inode->data.start == 0 && create)
+		extend_chain (inode, 0);
+	clst = chain_start (inode, clst_idx, &i);
+	while (clst != 0 && i < clst_idx) {
+		cluster_t next = fat_get (clst);
+		if (next == EOChain)
+			next = create ? extend_chain (inode, clst) : 0;
+		clst = next;
+		if (clst != 0)
+			remember (inode, ++i, clst);
+	}
+	if (clst != 0) {
+		remember (inode, clst_idx, clst);
+		sector = cluster_to_sector (clst) + idx % fat_sectors_per_cluster ();
+	}
+	lock_release (&inode->lock);
+	return sector;
+}
+
+/* Releases the clusters of removed INODE, including its own. */
+static void
+release_sectors (struct inode *inode) {
+	if (inode->data.start != 0)
+		fat_remove_chain (inode->data.start, 0);
+	fat_remove_chain (sector_to_cluster (inode->sector), 0);
 }
+#endif /* EFILESYS */
 
 /* List of open inodes, so that opening a single inode twice
  * returns the same `struct inode'. */
 static struct list open_inodes;
 
+/* In-memory inodes.  Each is a little over a sector, which malloc()
+ * would round up to a whole 1 kB block. */
+static struct slab_cache inode_slab;
+
 /* Initializes the inode module. */
 void
 inode_init (void) {
 	list_init (&open_inodes);
+	slab_cache_init (&inode_slab, "inode", sizeof (struct inode));
 }
 
 /* Initializes an inode with LENGTH bytes of data and
  * writes the new inode to sector SECTOR on the file system
- * disk.
+ * disk.  The data starts out as a hole: no sectors are allocated
+ * for it until it is written.
  * Returns true if successful.
- * Returns false if memory or disk allocation fails. */
+ * Returns false if memory allocation fails. */
 bool
 inode_create (disk_sector_t sector, off_t length) {
 	struct inode_disk *disk_inode = NULL;
@@ -77,20 +347,10 @@ inode_create (disk_sector_t sector, off_t length) {
 
 	disk_inode = calloc (1, sizeof *disk_inode);
 	if (disk_inode != NULL) {
-		size_t sectors = bytes_to_sectors (length);
 		disk_inode->length = length;
 		disk_inode->magic = INODE_MAGIC;
-		if (free_map_allocate (sectors, &disk_inode->start)) {
-			disk_write (filesys_disk, sector, disk_inode);
-			if (sectors > 0) {
-				static char zeros[DISK_SECTOR_SIZE];
-				size_t i;
-
-				for (i = 0; i < sectors; i++) 
-					disk_write (filesys_disk, disk_inode->start + i, zeros); 
-			}
-			success = true; 
-		} 
+		page_cache_write (sector, disk_inode, 0, DISK_SECTOR_SIZE);
+		success = true;
 		free (disk_inode);
 	}
 	return success;
@@ -115,7 +375,7 @@ inode_open (disk_sector_t sector) {
 	}
 
 	/* Allocate memory. */
-	inode = malloc (sizeof *inode);
+	inode = slab_alloc (&inode_slab);
 	if (inode == NULL)
 		return NULL;
 
@@ -125,7 +385,16 @@ inode_open (disk_sector_t sector) {
 	inode->open_cnt = 1;
 	inode->deny_write_cnt = 0;
 	inode->removed = false;
-	disk_read (filesys_disk, inode->sector, &inode->data);
+	lock_init (&inode->lock);
+#ifndef EFILESYS
+	inode->group_block = 0;
+	inode->alloc_hint = sector + 1;
+#else
+	inode->last_clst = 0;
+	inode->ckpts = NULL;
+	inode->ckpt_cnt = inode->ckpt_cap = 0;
+#endif
+	page_cache_read (inode->sector, &inode->data, 0, DISK_SECTOR_SIZE);
 	return inode;
 }
 
@@ -158,13 +427,13 @@ inode_close (struct inode *inode) {
 		list_remove (&inode->elem);
 
 		/* Deallocate blocks if removed. */
-		if (inode->removed) {
-			free_map_release (inode->sector, 1);
-			free_map_release (inode->data.start,
-					bytes_to_sectors (inode->data.length)); 
-		}
+		if (inode->removed)
+			release_sectors (inode);
 
-		free (inode); 
+#ifdef EFILESYS
+		free (inode->ckpts);
+#endif
+		slab_free (&inode_slab, inode);
 	}
 }
 
@@ -183,12 +452,11 @@ off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 	uint8_t *buffer = buffer_;
 	off_t bytes_read = 0;
-	uint8_t *bounce = NULL;
 
 	while (size > 0) {
 		/* Disk sector to read, starting byte offset within sector. */
-		disk_sector_t sector_idx = byte_to_sector (inode, offset);
 		int sector_ofs = offset % DISK_SECTOR_SIZE;
+		disk_sector_t sector_idx;
 
 		/* Bytes left in inode, bytes left in sector, lesser of the two. */
 		off_t inode_left = inode_length (inode) - offset;
@@ -200,89 +468,95 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 		if (chunk_size <= 0)
 			break;
 
-		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
-			/* Read full sector directly into caller's buffer. */
-			disk_read (filesys_disk, sector_idx, buffer + bytes_read); 
-		} else {
-			/* Read sector into bounce buffer, then partially copy
-			 * into caller's buffer. */
-			if (bounce == NULL) {
-				bounce = malloc (DISK_SECTOR_SIZE);
-				if (bounce == NULL)
-					break;
-			}
-			disk_read (filesys_disk, sector_idx, bounce);
-			memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-		}
+		/* A hole reads as zeros. */
+		sector_idx = byte_to_sector (inode, offset, false);
+		if (sector_idx != 0)
+			page_cache_read (sector_idx, buffer + bytes_read, sector_ofs,
+					chunk_size);
+		else
+			memset (buffer + bytes_read, 0, chunk_size);
 
 		/* Advance. */
 		size -= chunk_size;
 		offset += chunk_size;
 		bytes_read += chunk_size;
 	}
-	free (bounce);
 
 	return bytes_read;
 }
 
+/* Asks for the sectors holding the SIZE bytes of INODE at OFFSET to be
+ * read into the page cache in the background.  Bytes past the end of
+ * INODE and holes are ignored.
+ *
+ * With the FAT, the range is stretched to the end of the cluster it
+ * ends in.  The sectors of a cluster are adjacent on disk, so the
+ * worker reads them back to back, though still one request each. */
+void
+inode_readahead (struct inode *inode, off_t offset, off_t size) {
+	off_t length = inode_length (inode);
+	off_t end = offset + size;
+
+#ifdef EFILESYS
+	end = ROUND_UP (end, fat_sectors_per_cluster () * DISK_SECTOR_SIZE);
+#endif
+	if (end > length)
+		end = length;
+
+	for (offset = ROUND_DOWN (offset, DISK_SECTOR_SIZE); offset < end;
+			offset += DISK_SECTOR_SIZE) {
+		disk_sector_t sector = byte_to_sector (inode, offset, false);
+		if (sector != 0)
+			page_cache_readahead (sector);
+	}
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
+ * Writing past the end of INODE extends it, and any gap between the
+ * old end and OFFSET becomes a hole.
  * Returns the number of bytes actually written, which may be
- * less than SIZE if end of file is reached or an error occurs.
- * (Normally a write at end of file would extend the inode, but
- * growth is not yet implemented.) */
+ * less than SIZE if the disk fills up or the file reaches its
+ * largest size. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 		off_t offset) {
 	const uint8_t *buffer = buffer_;
 	off_t bytes_written = 0;
-	uint8_t *bounce = NULL;
 
 	if (inode->deny_write_cnt)
 		return 0;
 
 	while (size > 0) {
 		/* Sector to write, starting byte offset within sector. */
-		disk_sector_t sector_idx = byte_to_sector (inode, offset);
+		disk_sector_t sector_idx = byte_to_sector (inode, offset, true);
 		int sector_ofs = offset % DISK_SECTOR_SIZE;
 
-		/* Bytes left in inode, bytes left in sector, lesser of the two. */
-		off_t inode_left = inode_length (inode) - offset;
-		int sector_left = DISK_SECTOR_SIZE - sector_ofs;
-		int min_left = inode_left < sector_left ? inode_left : sector_left;
-
 		/* Number of bytes to actually write into this sector. */
-		int chunk_size = size < min_left ? size : min_left;
-		if (chunk_size <= 0)
+		int sector_left = DISK_SECTOR_SIZE - sector_ofs;
+		int chunk_size = size < sector_left ? size : sector_left;
+		if (sector_idx == 0)
 			break;
 
-		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
-			/* Write full sector directly to disk. */
-			disk_write (filesys_disk, sector_idx, buffer + bytes_written); 
-		} else {
-			/* We need a bounce buffer. */
-			if (bounce == NULL) {
-				bounce = malloc (DISK_SECTOR_SIZE);
-				if (bounce == NULL)
-					break;
-			}
-
-			/* If the sector contains data before or after the chunk
-			   we're writing, then we need to read in the sector
-			   first.  Otherwise we start with a sector of all zeros. */
-			if (sector_ofs > 0 || chunk_size < sector_left) 
-				disk_read (filesys_disk, sector_idx, bounce);
-			else
-				memset (bounce, 0, DISK_SECTOR_SIZE);
-			memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-			disk_write (filesys_disk, sector_idx, bounce); 
-		}
+		page_cache_write (sector_idx, buffer + bytes_written, sector_ofs,
+				chunk_size);
 
 		/* Advance. */
 		size -= chunk_size;
 		offset += chunk_size;
 		bytes_written += chunk_size;
 	}
-	free (bounce);
+
+	/* Extend INODE over what was written, which ends at OFFSET.  A
+	 * write that wrote nothing, because it was empty or the first
+	 * sector could not be allocated, leaves the length alone.  The
+	 * data went in first, so that readers never see the new length
+	 * before it. */
+	lock_acquire (&inode->lock);
+	if (bytes_written > 0 && offset > inode->data.length) {
+		inode->data.length = offset;
+		page_cache_write (inode->sector, &inode->data, 0, DISK_SECTOR_SIZE);
+	}
+	lock_release (&inode->lock);
 
 	return bytes_written;
 }
@@ -1,50 +1,439 @@
-/* page_cache.c: Implementation of Page Cache (Buffer Cache). */
-
-#include "vm/vm.h"
-static bool page_cache_readahead (struct page *page, void *kva);
-static bool page_cache_writeback (struct page *page);
-static void page_cache_destroy (struct page *page);
-
-/* DO NOT MODIFY this struct */
-static const struct page_operations page_cache_op = {
-	.swap_in = page_cache_readahead,
-	.swap_out = page_cache_writeback,
-	.destroy = page_cache_destroy,
-	.type = VM_PAGE_CACHE,
+/* page_cache.c: Implementation of Page Cache (Buffer Cache).
+ *
+ * Every sector the file system reads or writes goes through a cache of
+ * CACHE_SIZE sectors, so that a hot inode, directory or file block is
+ * read from disk once and then served from memory, and a run of small
+ * writes to one sector costs a single disk write when the sector is
+ * evicted or flushed.
+ *
+ * A sector is found through a hash table keyed by sector number.  When
+ * a sector that is not cached is wanted, the clock algorithm picks the
+ * entry to reuse: the hand sweeps the entries, giving a second chance
+ * to those used since it last passed and skipping those in use, and
+ * takes the first one left.  A dirty victim is written back before it
+ * is reused, without holding CACHE_LOCK.
+ *
+ * CACHE_LOCK guards the table and the bookkeeping of every entry.  The
+ * data of an entry is guarded by the entry's own lock, which is held
+ * while the sector is read or copied, so that work on different
+ * sectors proceeds in parallel.  An entry with a nonzero PIN_CNT is in
+ * use or waited for and is never evicted.
+ *
+ * Reading a file in order would still wait for the disk at every
+ * sector.  So when the file layer sees sequential reads, it queues the
+ * sectors that come next with page_cache_readahead(), and the
+ * "readahead" worker thread brings them in while the reader is busy
+ * with the ones it has.  The queue is only a hint: requests that find
+ * it full are dropped.
+ *
+ * Writes only dirty the cache.  The "flusher" thread writes dirty
+ * sectors behind the writers: every FLUSH_PERIOD ticks while there is
+ * anything dirty, it writes back the sectors that have been dirty for
+ * DIRTY_AGE ticks or more, so that a crash loses at most that much
+ * work, and, once more than DIRTY_HIGH entries are dirty, enough of the
+ * others to bring them down to DIRTY_LOW, so that eviction seldom has
+ * to wait for a write. */
+
+#include "filesys/page_cache.h"
+#include <debug.h>
+#include <hash.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "devices/timer.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Number of sectors cached. */
+#define CACHE_SIZE 64
+
+/* Number of read-ahead requests that can be queued. */
+#define READAHEAD_QUEUE 32
+
+/* Write-behind parameters. */
+#define FLUSH_PERIOD (TIMER_FREQ / 10)  /* Ticks between flusher runs. */
+#define DIRTY_AGE (2 * TIMER_FREQ)      /* Oldest a dirty sector gets. */
+#define DIRTY_HIGH (CACHE_SIZE / 2)     /* Dirty entries that start... */
+#define DIRTY_LOW (CACHE_SIZE / 4)      /* ...and stop a flush. */
+
+/* A cached sector. */
+struct cache_entry {
+	struct hash_elem elem;      /* Element in CACHE, if IN_USE. */
+	disk_sector_t sector;       /* Sector held, if IN_USE. */
+	bool in_use;                /* Holds a sector? */
+	bool accessed;              /* Used since the clock hand passed? */
+	int pin_cnt;                /* Threads using or waiting for it. */
+
+	/* Guarded by LOCK. */
+	struct lock lock;
+	bool valid;                 /* DATA holds the sector's contents? */
+	bool dirty;                 /* DATA is newer than the disk? */
+	int64_t dirty_since;        /* When DIRTY was set, in timer ticks. */
+	uint8_t *data;              /* DISK_SECTOR_SIZE bytes. */
 };
 
-tid_t page_cache_workerd;
+static struct cache_entry entries[CACHE_SIZE];
+static struct hash cache;           /* Entries that are IN_USE. */
+static struct lock cache_lock;
+static struct condition cache_unpinned; /* Signaled when an entry's
+                                           PIN_CNT drops to 0. */
+static size_t clock_hand;
+
+/* Sectors queued for the read-ahead worker, guarded by CACHE_LOCK. */
+static disk_sector_t readahead_queue[READAHEAD_QUEUE];
+static size_t readahead_head, readahead_cnt;
+static struct condition readahead_queued;
+
+/* Number of dirty entries, guarded by CACHE_LOCK.  The flusher waits
+ * on CACHE_DIRTIED for it to become nonzero. */
+static size_t dirty_cnt;
+static struct condition cache_dirtied;
 
-/* The initializer of file vm */
+/* Statistics. */
+static long long access_cnt, miss_cnt, writeback_cnt;
+static long long prefetch_cnt;      /* Sectors read by the worker. */
+static long long behind_cnt;        /* Sectors written by the flusher. */
+
+static uint64_t entry_hash (const struct hash_elem *, void *);
+static bool entry_less (const struct hash_elem *, const struct hash_elem *,
+		void *);
+static void page_cache_kworkerd (void *);
+static void page_cache_flusher (void *);
+
+/* Hook called by vm_init().  The cache holds sectors, not VM pages,
+ * and is set up by page_cache_init() from filesys_init() instead, so
+ * there is nothing to do here. */
 void
 pagecache_init (void) {
-	/* TODO: Create a worker daemon for page cache with page_cache_kworkerd */
 }
 
-/* Initialize the page cache */
-bool
-page_cache_initializer (struct page *page, enum vm_type type, void *kva) {
-	/* Set up the handler */
-	page->operations = &page_cache_op;
+/* Initializes the page cache. */
+void
+page_cache_init (void) {
+	uint8_t *data = palloc_get_multiple (PAL_ASSERT,
+			CACHE_SIZE * DISK_SECTOR_SIZE / PGSIZE);
+
+	hash_init (&cache, entry_hash, entry_less, NULL);
+	lock_init (&cache_lock);
+	cond_init (&cache_unpinned);
+	cond_init (&readahead_queued);
+	cond_init (&cache_dirtied);
+	for (size_t i = 0; i < CACHE_SIZE; i++) {
+		struct cache_entry *e = &entries[i];
+		e->in_use = false;
+		e->pin_cnt = 0;
+		lock_init (&e->lock);
+		e->data = data + i * DISK_SECTOR_SIZE;
+	}
+	thread_create ("readahead", PRI_DEFAULT, page_cache_kworkerd, NULL);
+	thread_create ("flusher", PRI_DEFAULT, page_cache_flusher, NULL);
+}
 
+static uint64_t
+entry_hash (const struct hash_elem *e, void *aux UNUSED) {
+	return hash_int (hash_entry (e, struct cache_entry, elem)->sector);
 }
 
-/* Utilze the Swap in mechanism to implement readhead */
 static bool
-page_cache_readahead (struct page *page, void *kva) {
+entry_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct cache_entry, elem)->sector
+		< hash_entry (b, struct cache_entry, elem)->sector;
+}
+
+/* Returns the entry holding SECTOR, or a null pointer.
+ * CACHE_LOCK must be held. */
+static struct cache_entry *
+lookup (disk_sector_t sector) {
+	struct cache_entry key;
+	struct hash_elem *e;
+
+	key.sector = sector;
+	e = hash_find (&cache, &key.elem);
+	return e != NULL ? hash_entry (e, struct cache_entry, elem) : NULL;
 }
 
-/* Utilze the Swap out mechanism to implement writeback */
+/* Writes E to disk if it is dirty.  Returns true if it was.  E's lock
+ * must be held. */
 static bool
-page_cache_writeback (struct page *page) {
+cache_writeback (struct cache_entry *e) {
+	if (!e->dirty)
+		return false;
+	disk_write (filesys_disk, e->sector, e->data);
+	e->dirty = false;
+	return true;
 }
 
-/* Destory the page_cache. */
+/* Picks an entry to reuse with the clock algorithm, writes it back if
+ * it is dirty and takes it out of the table.  Waits if every entry is
+ * in use.  CACHE_LOCK must be held, but is released while waiting and
+ * while writing. */
+static struct cache_entry *
+evict (void) {
+	struct cache_entry *e;
+	size_t scanned = 0;
+
+	for (;;) {
+		if (scanned == 2 * CACHE_SIZE) {
+			cond_wait (&cache_unpinned, &cache_lock);
+			scanned = 0;
+		}
+		e = &entries[clock_hand];
+		clock_hand = (clock_hand + 1) % CACHE_SIZE;
+		scanned++;
+		if (e->pin_cnt > 0)
+			continue;
+		if (!e->in_use)
+			return e;
+		if (e->accessed) {
+			e->accessed = false;
+			continue;
+		}
+		if (!e->dirty)
+			break;
+
+		/* Write E back with only its own lock, which nobody holds
+		 * since E is not pinned.  E stays in the table meanwhile, so a
+		 * miss on its sector finds it there and waits for the lock
+		 * rather than reading the old contents from disk. */
+		e->pin_cnt++;
+		lock_acquire (&e->lock);
+		lock_release (&cache_lock);
+		cache_writeback (e);
+		lock_release (&e->lock);
+		lock_acquire (&cache_lock);
+		dirty_cnt--;
+		writeback_cnt++;
+		if (--e->pin_cnt == 0)
+			cond_signal (&cache_unpinned, &cache_lock);
+
+		/* Someone may have used E while it was being written. */
+		if (e->pin_cnt == 0 && !e->accessed && !e->dirty)
+			break;
+	}
+
+	hash_delete (&cache, &e->elem);
+	e->in_use = false;
+	return e;
+}
+
+/* Returns the entry for SECTOR, pinned, giving it an entry if it has
+ * none.  Sets *HIT to whether it had one already.  CACHE_LOCK must be
+ * held. */
+static struct cache_entry *
+cache_pin (disk_sector_t sector, bool *hit) {
+	struct cache_entry *e = lookup (sector);
+
+	*hit = e != NULL;
+	if (e == NULL) {
+		struct cache_entry *victim = evict ();
+
+		/* evict() may have let go of CACHE_LOCK, and someone else may
+		 * have brought SECTOR in meanwhile. */
+		e = lookup (sector);
+		if (e == NULL) {
+			e = victim;
+			e->sector = sector;
+			e->in_use = true;
+			e->valid = false;
+			e->dirty = false;
+			hash_insert (&cache, &e->elem);
+		}
+	}
+	e->accessed = true;
+	e->pin_cnt++;
+	return e;
+}
+
+/* Returns the entry for SECTOR, pinned and with its lock held.  Unless
+ * WHOLE, in which case the caller is about to overwrite the whole
+ * sector, the entry's data is valid. */
+static struct cache_entry *
+cache_get (disk_sector_t sector, bool whole) {
+	struct cache_entry *e;
+	bool hit;
+
+	lock_acquire (&cache_lock);
+	e = cache_pin (sector, &hit);
+	access_cnt++;
+	if (!hit)
+		miss_cnt++;
+	lock_release (&cache_lock);
+
+	lock_acquire (&e->lock);
+	if (!e->valid && !whole) {
+		disk_read (filesys_disk, sector, e->data);
+		e->valid = true;
+	}
+	return e;
+}
+
+/* Releases entry E obtained from cache_get().  DIRTIED is 1 if the
+ * caller made E dirty, -1 if it wrote E back, and otherwise 0. */
 static void
-page_cache_destroy (struct page *page) {
+cache_put (struct cache_entry *e, int dirtied) {
+	lock_release (&e->lock);
+
+	lock_acquire (&cache_lock);
+	if (--e->pin_cnt == 0)
+		cond_signal (&cache_unpinned, &cache_lock);
+	if (dirtied > 0 && dirty_cnt++ == 0)
+		cond_signal (&cache_dirtied, &cache_lock);
+	else if (dirtied < 0)
+		dirty_cnt--;
+	lock_release (&cache_lock);
 }
 
-/* Worker thread for page cache */
+/* Copies SIZE bytes starting at byte OFS of SECTOR into BUFFER. */
+void
+page_cache_read (disk_sector_t sector, void *buffer, int ofs, int size) {
+	struct cache_entry *e;
+
+	ASSERT (ofs >= 0 && size >= 0 && ofs + size <= DISK_SECTOR_SIZE);
+
+	e = cache_get (sector, false);
+	memcpy (buffer, e->data + ofs, size);
+	cache_put (e, 0);
+}
+
+/* Copies SIZE bytes from BUFFER into SECTOR starting at byte OFS.  The
+ * sector reaches the disk when it is evicted or flushed. */
+void
+page_cache_write (disk_sector_t sector, const void *buffer, int ofs,
+		int size) {
+	struct cache_entry *e;
+	bool was_dirty;
+
+	ASSERT (ofs >= 0 && size >= 0 && ofs + size <= DISK_SECTOR_SIZE);
+
+	e = cache_get (sector, size == DISK_SECTOR_SIZE);
+	memcpy (e->data + ofs, buffer, size);
+	e->valid = true;
+	was_dirty = e->dirty;
+	if (!was_dirty) {
+		e->dirty = true;
+		e->dirty_since = timer_ticks ();
+	}
+	cache_put (e, !was_dirty);
+}
+
+/* Writes back the dirty entries that have been dirty since NOW -
+ * DIRTY_AGE or earlier, or all of them if ALL.  If more than
+ * DIRTY_HIGH entries are dirty to begin with, also writes others back
+ * until only DIRTY_LOW are left.  Returns the number written. */
+static size_t
+flush_dirty (bool all, int64_t now) {
+	size_t written = 0;
+	bool over;
+
+	lock_acquire (&cache_lock);
+	over = dirty_cnt > DIRTY_HIGH;
+	lock_release (&cache_lock);
+
+	for (size_t i = 0; i < CACHE_SIZE; i++) {
+		struct cache_entry *e = &entries[i];
+		bool flush = all;
+		int dirtied = 0;
+
+		/* E's DIRTY is only a hint until we hold its lock. */
+		lock_acquire (&cache_lock);
+		if (!e->in_use || !e->dirty) {
+			lock_release (&cache_lock);
+			continue;
+		}
+		if (over && dirty_cnt > DIRTY_LOW)
+			flush = true;
+		e->pin_cnt++;
+		lock_release (&cache_lock);
+
+		lock_acquire (&e->lock);
+		if ((flush || now - e->dirty_since >= DIRTY_AGE)
+				&& cache_writeback (e)) {
+			dirtied = -1;
+			written++;
+		}
+		cache_put (e, dirtied);
+	}
+
+	lock_acquire (&cache_lock);
+	writeback_cnt += written;
+	lock_release (&cache_lock);
+	return written;
+}
+
+/* Writes every dirty sector to disk. */
+void
+page_cache_flush (void) {
+	flush_dirty (true, timer_ticks ());
+}
+
+/* Write-behind thread.  While any sector is dirty, wakes up every
+ * FLUSH_PERIOD ticks to bring the free map file up to date and write
+ * back the sectors that have waited too long or are too many. */
 static void
-page_cache_kworkerd (void *aux) {
+page_cache_flusher (void *aux UNUSED) {
+	for (;;) {
+		lock_acquire (&cache_lock);
+		while (dirty_cnt == 0)
+			cond_wait (&cache_dirtied, &cache_lock);
+		lock_release (&cache_lock);
+
+		timer_sleep (FLUSH_PERIOD);
+		free_map_sync ();
+		behind_cnt += flush_dirty (false, timer_ticks ());
+	}
+}
+
+/* Asks for SECTOR to be read into the cache in the background, unless
+ * it is there already. */
+void
+page_cache_readahead (disk_sector_t sector) {
+	lock_acquire (&cache_lock);
+	if (lookup (sector) == NULL && readahead_cnt < READAHEAD_QUEUE) {
+		readahead_queue[(readahead_head + readahead_cnt++) % READAHEAD_QUEUE]
+			= sector;
+		cond_signal (&readahead_queued, &cache_lock);
+	}
+	lock_release (&cache_lock);
+}
+
+/* Read-ahead worker.  Reads the queued sectors into the cache. */
+static void
+page_cache_kworkerd (void *aux UNUSED) {
+	for (;;) {
+		struct cache_entry *e;
+		disk_sector_t sector;
+		bool hit;
+
+		lock_acquire (&cache_lock);
+		while (readahead_cnt == 0)
+			cond_wait (&readahead_queued, &cache_lock);
+		sector = readahead_queue[readahead_head];
+		readahead_head = (readahead_head + 1) % READAHEAD_QUEUE;
+		readahead_cnt--;
+		e = cache_pin (sector, &hit);
+		lock_release (&cache_lock);
+
+		/* A reader that wants the sector before it arrives waits on
+		 * the entry's lock rather than reading it a second time. */
+		lock_acquire (&e->lock);
+		if (!e->valid) {
+			disk_read (filesys_disk, sector, e->data);
+			e->valid = true;
+			prefetch_cnt++;
+		}
+		cache_put (e, 0);
+	}
+}
+
+/* Prints page cache statistics. */
+void
+page_cache_print_stats (void) {
+	printf ("Page cache: %lld hits, %lld misses, %lld write-backs "
+			"(%lld behind writers), %lld sectors read ahead\n",
+			access_cnt - miss_cnt, miss_cnt, writeback_cnt, behind_cnt,
+			prefetch_cnt);
 }
@@ -1,12 +1,15 @@
 #ifndef FILESYS_PAGE_CACHE_H
 #define FILESYS_PAGE_CACHE_H
-#include "vm/vm.h"
-
-struct page;
-enum vm_type;
+#include "devices/disk.h"
 
+/* Cache pages are not VM pages; see page_cache.c. */
 struct page_cache {};
 
+void pagecache_init (void);
 void page_cache_init (void);
-bool page_cache_initializer (struct page *page, enum vm_type type, void *kva);
+void page_cache_read (disk_sector_t, void *buffer, int ofs, int size);
+void page_cache_write (disk_sector_t, const void *buffer, int ofs, int size);
+void page_cache_readahead (disk_sector_t);
+void page_cache_flush (void);
+void page_cache_print_stats (void);
 #endif
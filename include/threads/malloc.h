@@ -4,7 +4,20 @@
 #include <debug.h>
 #include <stddef.h>
 
+/* Number of block sizes malloc() keeps descriptors for:
+   16, 32, ..., 1024 bytes. */
+#define MALLOC_CLASS_CNT 7
+
+/* Free blocks of one size cached by a thread, so that most calls
+   to malloc() and free() need no lock.  The blocks are linked
+   through their first word. */
+struct malloc_magazine {
+	void *top;                  /* Most recently cached block. */
+	size_t cnt;                 /* Number of blocks cached. */
+};
+
 void malloc_init (void);
+void malloc_flush (void);
 void *malloc (size_t) __attribute__ ((malloc));
 void *calloc (size_t, size_t) __attribute__ ((malloc));
 void *realloc (void *, size_t);
@@ -0,0 +1,30 @@
+#ifndef THREADS_SLAB_H
+#define THREADS_SLAB_H
+
+#include <list.h>
+#include <stddef.h>
+#include "threads/synch.h"
+
+/* A cache of objects of a single type. */
+struct slab_cache {
+	const char *name;           /* Name, for statistics. */
+	size_t obj_size;            /* Size of each object in bytes. */
+	size_t objs_per_slab;       /* Number of objects in a slab. */
+	struct list partial;        /* Slabs with free objects. */
+	struct lock lock;           /* Lock. */
+
+	/* Statistics. */
+	size_t slab_cnt;            /* Slabs allocated now. */
+	size_t in_use;              /* Objects allocated now... */
+	size_t peak;                /* ...and at most. */
+	long long allocs;           /* Calls to slab_alloc(). */
+	long long frees;            /* Calls to slab_free(). */
+};
+
+void slab_cache_init (struct slab_cache *, const char *name,
+		size_t obj_size);
+void *slab_alloc (struct slab_cache *) __attribute__ ((malloc));
+void slab_free (struct slab_cache *, void *);
+void slab_print_stats (void);
+
+#endif /* threads/slab.h */
@@ -5,6 +5,7 @@
 #include <list.h>
 #include <stdint.h>
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/synch.h"
 #define USERPROG
 #define VM
@@ -127,6 +128,9 @@ struct thread
    /* Shared between thread.c and synch.c. */
    struct list_elem elem; /* List element. */
 
+   /* Owned by threads/malloc.c. */
+   struct malloc_magazine magazines[MALLOC_CLASS_CNT];
+
 #ifdef USERPROG
    /* Owned by userprog/process.c. */
    uint64_t *pml4; /* Page map level 4 */
@@ -14,10 +14,17 @@ struct file *process_get_file(int fd);
 void process_close_file(int fd);
 void remove_child_process(struct thread *cp);
 bool lazy_load_segment(struct page *page, void *aux);
+/* Where a lazily loaded page comes from.  A segment holds its own
+   reference to INODE, released by segment_free(). */
 struct segment {
-    struct file *file;
+    struct inode *inode;
     off_t ofs;
     uint32_t read_bytes;
     uint32_t zero_bytes;
 };
+void segment_init(void);
+struct segment *segment_create(struct inode *inode, off_t ofs,
+                               uint32_t read_bytes, uint32_t zero_bytes);
+struct segment *segment_duplicate(const struct segment *seg);
+void segment_free(struct segment *seg);
 #endif /* userprog/process.h */
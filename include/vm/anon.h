@@ -5,9 +5,12 @@ struct page;
 enum vm_type;
 
 struct anon_page {
+	size_t swap_slot;           /* Swap slot holding the page, or
+	                               BITMAP_ERROR while it is resident. */
 };
 
 void vm_anon_init (void);
 bool anon_initializer (struct page *page, enum vm_type type, void *kva);
+bool anon_swap_copy (struct page *page, void *kva);
 
 #endif
@@ -7,11 +7,19 @@ struct page;
 enum vm_type;
 
 struct file_page {
+	struct inode *inode;   /* Backing inode, opened for this page. */
+	off_t ofs;             /* Offset of the page in the file. */
+	size_t read_bytes;     /* Bytes read from the file... */
+	size_t zero_bytes;     /* ...and zeroed after them. */
+	bool text;             /* Shared executable text? */
 };
 
 void vm_file_init (void);
+void vm_file_print_stats (void);
 bool file_backed_initializer (struct page *page, enum vm_type type, void *kva);
 void *do_mmap(void *addr, size_t length, int writable,
 		struct file *file, off_t offset);
 void do_munmap (void *va);
+bool file_page_text_key (struct page *page, struct inode **inode,
+		off_t *ofs);
 #endif
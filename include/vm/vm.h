@@ -26,6 +26,8 @@ enum vm_type {
 
 	VM_STACK =  (VM_MARKER_0 | VM_ANON),
 	VM_FILE_SWAP = (VM_FILE | VM_MARKER_1),
+	/* Read-only executable text, shared between processes. */
+	VM_FILE_TEXT = (VM_FILE | VM_MARKER_0),
 	VM_ANON_SWAP = (VM_ANON | VM_MARKER_2),
 	
 	/* DO NOT EXCEED THIS VALUE. */
@@ -36,6 +38,7 @@ enum vm_type {
 #include "vm/uninit.h"
 #include "vm/anon.h"
 #include "vm/file.h"
+#include "vm/vma.h"
 #ifdef EFILESYS
 #include "filesys/page_cache.h"
 #endif
@@ -54,13 +57,15 @@ struct page {
 	void *va;              /* Address in terms of user space */
 	struct frame *frame;   /* Back reference for frame */
 	/* Your implementation */
+	struct thread *owner;  /* Thread whose address space holds the page. */
+	struct list_elem share_elem; /* Element in frame's sharer list. */
 	bool is_loaded; // 물리메모리의 탑재 여부를 알려주는 플래그
 	struct file *file_;
-	struct list_elem mmap_elem; // mmap 리스트 element
+	struct vma *vma;       /* Region the page belongs to, or NULL. */
+	struct list_elem vma_elem; /* Element in the region's page list. */
 	off_t offset; // 읽어야 할 파일 오프셋
 	size_t read_bytes; // 가상페이지에 쓰여져 있는 데이터 크기
 	size_t zero_bytes; // 0으로 채울 남은 페이지의 바이트
-	size_t swap_slot;		
 	struct hash_elem elem; // 해시테이블 element
 	bool writable; // true일 경우 해당 주소에 write 가능, false일 때 불가능
 
@@ -76,13 +81,40 @@ struct page {
 	};
 };
 
-/* The representation of "frame" */
+/* The representation of "frame".  There is one per page of the user
+ * pool, kept in a table indexed by physical frame number, so the pages
+ * mapping a frame are found from its address in constant time. */
 struct frame {
 	void *kva;
-	struct page *page;
-	struct list_elem frame_elem;
+	struct page *page;           /* One of the pages in PAGES. */
+	struct list pages;           /* Pages mapping this frame. */
+	int ref_cnt;                 /* Number of entries in PAGES. */
+	int pin_cnt;                 /* Never evicted while nonzero. */
+	bool evicting;               /* Being written out by an evictor. */
+	struct list_elem frame_elem; /* In-use list element, oldest first. */
+
+	/* Executable text cached for sharing, or a null TEXT_INODE. */
+	struct inode *text_inode;
+	off_t text_ofs;
+	struct hash_elem text_elem;
 };
 
+/* Frame replacement policies, selected by the "-evict=" option. */
+enum vm_evict_policy {
+	VM_EVICT_FIFO,              /* Oldest frame first. */
+	VM_EVICT_CLOCK,             /* Second chance on the accessed bit. */
+	VM_EVICT_ECLOCK,            /* Enhanced second chance: prefer clean. */
+	VM_EVICT_CNT
+};
+
+extern enum vm_evict_policy vm_evict_policy;
+
+/* Pages of a lazily loaded segment populated per fault (-fault-around). */
+extern size_t vm_fault_around;
+
+/* Map whole 2 MiB regions of pending pages at once (-huge-pages). */
+extern bool vm_huge_pages;
+
 /* The function table for page operations.
  * This is one way of implementing "interface" in C.
  * Put the table of "method" into the struct's member, and
@@ -103,7 +135,8 @@ struct page_operations {
  * We don't want to force you to obey any specific design for this struct.
  * All designs up to you for this. */
 struct supplemental_page_table {
-	struct hash hash;
+	struct hash hash;          /* Pages touched so far. */
+	struct vma_table vmas;     /* Every range the process may touch. */
 };
 
 #include "threads/thread.h"
@@ -113,10 +146,13 @@ bool supplemental_page_table_copy (struct supplemental_page_table *dst,
 void supplemental_page_table_kill (struct supplemental_page_table *spt);
 struct page *spt_find_page (struct supplemental_page_table *spt,
 		void *va);
+struct page *spt_get_page (struct supplemental_page_table *spt, void *va);
 bool spt_insert_page (struct supplemental_page_table *spt, struct page *page);
 void spt_remove_page (struct supplemental_page_table *spt, struct page *page);
 
 void vm_init (void);
+bool vm_set_evict_policy (const char *name);
+void vm_print_stats (void);
 bool vm_try_handle_fault (struct intr_frame *f, void *addr, bool user,
 		bool write, bool not_present);
 
@@ -125,6 +161,9 @@ bool vm_try_handle_fault (struct intr_frame *f, void *addr, bool user,
 bool vm_alloc_page_with_initializer (enum vm_type type, void *upage,
 		bool writable, vm_initializer *init, void *aux);
 void vm_dealloc_page (struct page *page);
+void vm_free_frame (struct page *page);
+void vm_wait_eviction (struct page *page);
+struct frame *vm_frame_lookup (void *kva);
 bool vm_claim_page (void *va);
 enum vm_type page_get_type (struct page *page);
 
@@ -0,0 +1,50 @@
+#ifndef VM_VMA_H
+#define VM_VMA_H
+#include <list.h>
+#include "filesys/off_t.h"
+#include "vm/vm.h"
+
+struct file;
+struct inode;
+enum vm_type;
+
+/* A range of a process's address space whose pages are all set up the
+ * same way: a segment of the executable, a memory-mapped file or the
+ * stack.  Page objects exist only for the pages of the range that
+ * have been touched; the rest are described by the range alone. */
+struct vma {
+	void *start;             /* First page. */
+	void *end;               /* One past the last page. */
+	enum vm_type type;       /* Type of the pages created. */
+	bool writable;
+	vm_initializer *init;    /* Loader of the pages, or NULL. */
+	struct inode *inode;     /* Backing inode, or NULL for zeros. */
+	off_t ofs;               /* Offset of START in INODE. */
+	off_t read_bytes;        /* Bytes from INODE; the rest are zeros. */
+	struct file *file;       /* Mapped file, or NULL if not an mmap. */
+	struct list pages;       /* Pages created so far. */
+};
+
+/* A process's regions, sorted by address and never overlapping. */
+struct vma_table {
+	struct vma **vmas;
+	size_t cnt;
+	size_t cap;
+};
+
+void vma_init (void);
+void vma_table_init (struct vma_table *);
+bool vma_table_copy (struct vma_table *dst, const struct vma_table *src);
+void vma_table_destroy (struct vma_table *);
+
+struct vma *vma_create (void *start, size_t page_cnt, enum vm_type type,
+		bool writable, vm_initializer *init, struct inode *inode, off_t ofs,
+		off_t read_bytes);
+void vma_destroy (struct vma *);
+bool vma_insert (struct vma_table *, struct vma *);
+void vma_remove (struct vma_table *, struct vma *);
+struct vma *vma_find (const struct vma_table *, const void *va);
+bool vma_overlaps (const struct vma_table *, const void *start,
+		const void *end);
+bool vma_grow_down (struct vma_table *, struct vma *, void *start);
+#endif
@@ -62,6 +62,75 @@ last_mask (const struct bitmap *b) {
 	int last_bits = b->bit_cnt % ELEM_BITS;
 	return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
+
+/* Returns an elem_type in which the bits of the element holding
+   bit START that lie in [START, END) are turned on.  END may lie
+   in a later element, in which case the mask reaches the top bit. */
+static inline elem_type
+range_mask (size_t start, size_t end) {
+	elem_type mask = (elem_type) -1 << (start % ELEM_BITS);
+	if (end - (start - start % ELEM_BITS) < ELEM_BITS)
+		mask &= bit_mask (end) - 1;
+	return mask;
+}
+
+/* Returns the number of bits set in E.
+
+   This is the usual parallel count rather than
+   __builtin_popcountl(), which without a POPCNT instruction
+   turns into a call to libgcc, and the kernel does not link with
+   libgcc. */
+static inline unsigned
+popcount (elem_type e) {
+	e = e - ((e >> 1) & 0x5555555555555555UL);
+	e = (e & 0x3333333333333333UL) + ((e >> 2) & 0x3333333333333333UL);
+	e = (e + (e >> 4)) & 0x0f0f0f0f0f0f0f0fUL;
+	return (e * 0x0101010101010101UL) >> 56;
+}
+
+/* Returns element IDX of B with the bits set to VALUE turned on
+   and the rest, including any past the end of B, turned off. */
+static inline elem_type
+value_elem (const struct bitmap *b, size_t idx, bool value) {
+	elem_type e = value ? b->bits[idx] : ~b->bits[idx];
+	if (idx == elem_cnt (b->bit_cnt) - 1)
+		e &= last_mask (b);
+	return e;
+}
+
+/* Returns the index of the first bit in B at or after START and
+   before END that is set to VALUE, or END if there is none.
+   Elements with no such bit are skipped whole. */
+static size_t
+find_value (const struct bitmap *b, size_t start, size_t end, bool value) {
+	size_t idx, last;
+	elem_type e;
+
+	if (start >= end)
+		return end;
+	idx = elem_idx (start);
+	last = elem_idx (end - 1);
+	e = value_elem (b, idx, value) & ((elem_type) -1 << (start % ELEM_BITS));
+	while (e == 0) {
+		if (++idx > last)
+			return end;
+		e = value_elem (b, idx, value);
+	}
+	start = idx * ELEM_BITS + __builtin_ctzl (e);
+	return start < end ? start : end;
+}
+
+/* Atomically ORs MASK into element IDX of B. */
+static inline void
+elem_or (struct bitmap *b, size_t idx, elem_type mask) {
+	asm ("lock orq %1, %0" : "+m" (b->bits[idx]) : "r" (mask) : "cc");
+}
+
+/* Atomically ANDs MASK into element IDX of B. */
+static inline void
+elem_and (struct bitmap *b, size_t idx, elem_type mask) {
+	asm ("lock andq %1, %0" : "+m" (b->bits[idx]) : "r" (mask) : "cc");
+}
 
 /* Creation and destruction. */
 
@@ -197,30 +266,38 @@ bitmap_set_all (struct bitmap *b, bool value) {
 /* Sets the CNT bits starting at START in B to VALUE. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i;
+	size_t i, end;
 
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	for (i = 0; i < cnt; i++)
-		bitmap_set (b, start + i, value);
+	/* Each element is updated atomically, as by bitmap_set(). */
+	end = start + cnt;
+	for (i = start; i < end; i = (elem_idx (i) + 1) * ELEM_BITS) {
+		elem_type mask = range_mask (i, end);
+		if (value)
+			elem_or (b, elem_idx (i), mask);
+		else
+			elem_and (b, elem_idx (i), ~mask);
+	}
 }
 
 /* Returns the number of bits in B between START and START + CNT,
    exclusive, that are set to VALUE. */
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i, value_cnt;
+	size_t i, end, value_cnt;
 
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
 	value_cnt = 0;
-	for (i = 0; i < cnt; i++)
-		if (bitmap_test (b, start + i) == value)
-			value_cnt++;
+	end = start + cnt;
+	for (i = start; i < end; i = (elem_idx (i) + 1) * ELEM_BITS)
+		value_cnt += popcount (value_elem (b, elem_idx (i), value)
+				& range_mask (i, end));
 	return value_cnt;
 }
 
@@ -228,16 +305,11 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) {
    exclusive, are set to VALUE, and false otherwise. */
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i;
-
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	for (i = 0; i < cnt; i++)
-		if (bitmap_test (b, start + i) == value)
-			return true;
-	return false;
+	return find_value (b, start, start + cnt, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -266,18 +338,29 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt) {
 /* Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
-   If there is no such group, returns BITMAP_ERROR. */
+   If there is no such group, returns BITMAP_ERROR.
+
+   The search works a whole element at a time: it finds the next
+   bit set to VALUE, skipping elements that have none, then finds
+   the end of the run that bit starts, skipping elements that are
+   all VALUE, and resumes after the run if it is too short.  Each
+   element is thus looked at about once, whatever CNT is. */
 size_t
 bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) {
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 
+	if (cnt == 0)
+		return start;
 	if (cnt <= b->bit_cnt) {
 		size_t last = b->bit_cnt - cnt;
-		size_t i;
-		for (i = start; i <= last; i++)
-			if (!bitmap_contains (b, i, cnt, !value))
+		size_t i = start;
+		while ((i = find_value (b, i, last + 1, value)) <= last) {
+			size_t end = find_value (b, i, i + cnt, !value);
+			if (end == i + cnt)
 				return i;
+			i = end;
+		}
 	}
 	return BITMAP_ERROR;
 }
@@ -326,6 +409,23 @@ bitmap_write (const struct bitmap *b, struct file *file) {
 	off_t size = byte_cnt (b->bit_cnt);
 	return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the bytes of B from OFS up to OFS + SIZE to the same
+   place in FILE, leaving the rest of FILE alone.  Bytes past the
+   end of B are ignored.  Return true if successful, false
+   otherwise. */
+bool
+bitmap_write_range (const struct bitmap *b, struct file *file,
+		size_t ofs, size_t size) {
+	size_t file_size = byte_cnt (b->bit_cnt);
+
+	if (ofs >= file_size)
+		return true;
+	if (size > file_size - ofs)
+		size = file_size - ofs;
+	return file_write_at (file, (const uint8_t *) b->bits + ofs, size, ofs)
+		== (off_t) size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
@@ -0,0 +1,122 @@
+/* Measures bitmap_scan() on fragmented maps of 1M bits, in TSC
+   cycles, against a scan that tests one bit at a time the way
+   bitmap_scan() used to.
+
+   Each map has a single run of RUN_BITS free bits planted three
+   quarters of the way in, and scans for runs of several lengths
+   start from random points in the first half, so every scan
+   crosses a long stretch of fragments before it finds a fit.
+   The maps differ in how the fragments look:
+
+     - "half": every bit is used with probability 1/2.
+
+     - "sparse": one bit in 32 is free, at random.
+
+     - "full": every bit is used but the planted run.
+
+   slow_scan() serves as the reference: whatever it finds,
+   bitmap_scan() has to find too, and a mismatch ends the test
+   with the map, length and starting bit that disagreed. */
+
+#include <bitmap.h>
+#include <random.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "intrinsic.h"
+
+#define BIT_CNT (1024 * 1024)   /* Bits in each map. */
+#define RUN_BITS 64             /* Length of the planted free run. */
+#define SCAN_CNT 4              /* Scans per map and length. */
+
+static const size_t lengths[] = {1, 8, RUN_BITS};
+#define LENGTH_CNT (sizeof lengths / sizeof *lengths)
+
+/* Returns the start of the first run of CNT bits in B at or
+   after START that are all VALUE, testing one bit at a time. */
+static size_t
+slow_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
+{
+  size_t last = bitmap_size (b) - cnt;
+  size_t i, j;
+
+  for (i = start; i <= last; i++)
+    {
+      for (j = 0; j < cnt; j++)
+        if (bitmap_test (b, i + j) != value)
+          break;
+      if (j == cnt)
+        return i;
+    }
+  return BITMAP_ERROR;
+}
+
+/* Fills B so that a bit is free with probability 1 in FREE_ONE_IN,
+   or never if FREE_ONE_IN is 0, then plants the free run. */
+static void
+fill (struct bitmap *b, unsigned free_one_in)
+{
+  size_t i;
+
+  bitmap_set_all (b, true);
+  if (free_one_in != 0)
+    for (i = 0; i < BIT_CNT; i++)
+      if (random_ulong () % free_one_in == 0)
+        bitmap_reset (b, i);
+  bitmap_set_multiple (b, BIT_CNT / 4 * 3, RUN_BITS, false);
+}
+
+/* Times scans of B for free runs of each length. */
+static void
+bench (const char *name, struct bitmap *b)
+{
+  size_t i, j;
+
+  for (i = 0; i < LENGTH_CNT; i++)
+    {
+      uint64_t fast = 0, slow = 0, bits = 0;
+
+      for (j = 0; j < SCAN_CNT; j++)
+        {
+          size_t start = random_ulong () % (BIT_CNT / 2);
+          uint64_t t0, t1, t2;
+          size_t fast_idx, slow_idx;
+
+          t0 = rdtsc ();
+          fast_idx = bitmap_scan (b, start, lengths[i], false);
+          t1 = rdtsc ();
+          slow_idx = slow_scan (b, start, lengths[i], false);
+          t2 = rdtsc ();
+          if (fast_idx != slow_idx)
+            fail ("%s: run of %zu from %zu found at %zu, not %zu",
+                  name, lengths[i], start, fast_idx, slow_idx);
+          fast += t1 - t0;
+          slow += t2 - t1;
+          bits += fast_idx - start + lengths[i];
+        }
+      msg ("%s, run of %zu: %llu bits per kcycle word at a time, "
+           "%llu bit by bit", name, lengths[i],
+           (unsigned long long) (bits * 1000 / (fast + 1)),
+           (unsigned long long) (bits * 1000 / (slow + 1)));
+    }
+}
+
+void
+test_bitmap_bench (void)
+{
+  struct bitmap *b = bitmap_create (BIT_CNT);
+
+  if (b == NULL)
+    fail ("bitmap_create (%d) failed", BIT_CNT);
+  random_init (0);
+
+  fill (b, 2);
+  bench ("half", b);
+  fill (b, 32);
+  bench ("sparse", b);
+  fill (b, 0);
+  bench ("full", b);
+
+  bitmap_destroy (b);
+  pass ();
+}
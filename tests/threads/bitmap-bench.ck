@@ -0,0 +1,36 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+
+common_checks ("run", @output);
+
+@output = get_core_output ("run", @output);
+
+# Each map must report every run length exactly once.
+my (%pending);
+foreach my $map ('half', 'sparse', 'full') {
+    $pending{"$map, run of $_"} = 1 foreach 1, 8, 64;
+}
+
+my ($passed) = 0;
+foreach (@output) {
+    if ($_ eq '(bitmap-bench) PASS') {
+	$passed = 1;
+	next;
+    }
+    my ($key) = /^\(bitmap-bench\) (\w+, run of \d+): \d+ bits per kcycle word at a time, \d+ bit by bit$/;
+    next if !defined $key;
+    fail "no result expected for \"$key\"\n" if !exists $pending{$key};
+    fail "\"$key\" reported twice\n" if !$pending{$key};
+    $pending{$key} = 0;
+}
+
+my (@missing) = sort grep ($pending{$_}, keys %pending);
+fail "missing results for: " . join ('; ', @missing) . "\n" if @missing;
+fail "missing PASS in output\n" if !$passed;
+
+pass;
@@ -0,0 +1,141 @@
+/* Measures the cost of malloc() and free() in TSC cycles.
+
+   First times a malloc() immediately followed by a free() for
+   several block sizes, which the running thread's magazine
+   serves without taking a lock.  Then times bursts of
+   allocations that are all freed afterward, which also move
+   blocks between the magazine and the descriptor.  Finally runs
+   the bursts in several threads at once, so that they contend
+   for the descriptors.
+
+   Both ends of every block are stamped when it is allocated and
+   checked again before it is freed.  A block that is handed out
+   twice, or that overlaps another, fails the test. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "intrinsic.h"
+
+#define PAIR_ITERS 10000        /* malloc()/free() pairs per size. */
+#define BURST_SIZE 64           /* Blocks allocated per burst. */
+#define BURST_ITERS 200         /* Bursts per size. */
+#define THREAD_CNT 4            /* Threads in the contended run. */
+#define THREAD_SIZE 64          /* Block size in the contended run. */
+
+static const size_t sizes[] = {16, 40, 128, 500, 1024};
+#define SIZE_CNT (sizeof sizes / sizeof *sizes)
+
+/* Marks the first and last bytes of block P of SIZE bytes. */
+static void
+mark (uint8_t *p, size_t size, uint8_t v)
+{
+  p[0] = p[size - 1] = v;
+}
+
+/* Checks the marks left on P by mark(). */
+static void
+check (const uint8_t *p, size_t size, uint8_t v)
+{
+  if (p[0] != v || p[size - 1] != v)
+    fail ("block of %zu bytes was overwritten", size);
+}
+
+/* Returns the average cycles spent on a malloc()/free() pair of
+   SIZE bytes. */
+static uint64_t
+bench_pairs (size_t size)
+{
+  uint64_t start = rdtsc ();
+  int i;
+
+  for (i = 0; i < PAIR_ITERS; i++)
+    {
+      uint8_t *p = malloc (size);
+      if (p == NULL)
+        fail ("malloc (%zu) failed", size);
+      mark (p, size, i);
+      check (p, size, i);
+      free (p);
+    }
+  return (rdtsc () - start) / PAIR_ITERS;
+}
+
+/* Returns the average cycles per block spent allocating bursts
+   of BURST_SIZE blocks of SIZE bytes and then freeing them. */
+static uint64_t
+bench_bursts (size_t size)
+{
+  uint8_t *blocks[BURST_SIZE];
+  uint64_t start = rdtsc ();
+  int i, j;
+
+  for (i = 0; i < BURST_ITERS; i++)
+    {
+      for (j = 0; j < BURST_SIZE; j++)
+        {
+          blocks[j] = malloc (size);
+          if (blocks[j] == NULL)
+            fail ("malloc (%zu) failed", size);
+          mark (blocks[j], size, j);
+        }
+      for (j = 0; j < BURST_SIZE; j++)
+        {
+          check (blocks[j], size, j);
+          free (blocks[j]);
+        }
+    }
+  return (rdtsc () - start) / (BURST_ITERS * BURST_SIZE);
+}
+
+/* Result of one contending thread. */
+struct bench_thread
+  {
+    uint64_t cycles;            /* Average cycles per block. */
+    struct semaphore done;      /* Upped when finished. */
+  };
+
+static void
+burst_thread (void *bt_)
+{
+  struct bench_thread *bt = bt_;
+
+  bt->cycles = bench_bursts (THREAD_SIZE);
+  sema_up (&bt->done);
+}
+
+void
+test_malloc_bench (void)
+{
+  struct bench_thread threads[THREAD_CNT];
+  uint64_t total;
+  size_t i;
+
+  for (i = 0; i < SIZE_CNT; i++)
+    msg ("%zu bytes: %llu cycles per malloc/free pair", sizes[i],
+         (unsigned long long) bench_pairs (sizes[i]));
+  for (i = 0; i < SIZE_CNT; i++)
+    msg ("%zu bytes: %llu cycles per block in bursts of %d", sizes[i],
+         (unsigned long long) bench_bursts (sizes[i]), BURST_SIZE);
+
+  for (i = 0; i < THREAD_CNT; i++)
+    {
+      char name[16];
+      snprintf (name, sizeof name, "bench %zu", i);
+      sema_init (&threads[i].done, 0);
+      thread_create (name, PRI_DEFAULT, burst_thread, &threads[i]);
+    }
+  total = 0;
+  for (i = 0; i < THREAD_CNT; i++)
+    {
+      sema_down (&threads[i].done);
+      total += threads[i].cycles;
+    }
+  msg ("%d threads, %d bytes: %llu cycles per block in bursts of %d",
+       THREAD_CNT, THREAD_SIZE, (unsigned long long) (total / THREAD_CNT),
+       BURST_SIZE);
+  pass ();
+}
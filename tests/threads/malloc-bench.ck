@@ -0,0 +1,31 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+
+common_checks ("run", @output);
+
+@output = get_core_output ("run", @output);
+
+# One timing per block size for pairs, then for bursts, then the
+# contended run, in that order.
+my (@sizes) = (16, 40, 128, 500, 1024);
+my (@expected);
+push (@expected, map (qr/^\(malloc-bench\) $_ bytes: \d+ cycles per malloc\/free pair$/, @sizes));
+push (@expected, map (qr/^\(malloc-bench\) $_ bytes: \d+ cycles per block in bursts of 64$/, @sizes));
+push (@expected, qr/^\(malloc-bench\) 4 threads, 64 bytes: \d+ cycles per block in bursts of 64$/);
+push (@expected, qr/^\(malloc-bench\) PASS$/);
+
+my (@lines) = grep (/^\(malloc-bench\) / && !/\) (begin|end)$/, @output);
+foreach my $re (@expected) {
+    my ($line) = shift (@lines);
+    fail "output ended early, expected line matching $re\n"
+      if !defined $line;
+    fail "unexpected line \"$line\", expected one matching $re\n"
+      if $line !~ $re;
+}
+
+pass;
@@ -0,0 +1,118 @@
+/* Measures memcpy(), memmove() and memset() in TSC cycles, for
+   blocks from 8 bytes to 2 MB, against a loop that copies one
+   byte at a time the way memcpy() used to.
+
+   memmove() is timed on blocks that overlap with the destination
+   8 bytes above the source, which is the case that cannot go
+   upward; the largest such block is 8 bytes short of 2 MB, to
+   fit in the buffer.  Every size moves about BYTES_PER_SIZE bytes
+   in all, so that small blocks are timed over many calls.
+
+   Once a function has been timed at a size, the last block it
+   produced is compared byte for byte with what it should hold,
+   and the first wrong byte is reported as a failure. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+#include "intrinsic.h"
+
+#define BUF_SIZE (2 * 1024 * 1024)      /* Largest block. */
+#define BUF_PAGES (BUF_SIZE / PGSIZE)
+#define BYTES_PER_SIZE (4 * 1024 * 1024)
+
+static const size_t sizes[] =
+  {8, 24, 64, 256, 1024, 4096, 65536, BUF_SIZE};
+#define SIZE_CNT (sizeof sizes / sizeof *sizes)
+
+/* Copies SIZE bytes from SRC to DST one byte at a time. */
+static void
+byte_copy (uint8_t *dst, const uint8_t *src, size_t size)
+{
+  while (size-- > 0)
+    *dst++ = *src++;
+}
+
+/* Fills the SIZE bytes at P with a pattern that depends on SEED. */
+static void
+fill (uint8_t *p, size_t size, unsigned seed)
+{
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    p[i] = i * 7 + seed;
+}
+
+/* Fails if the SIZE bytes at P are not the pattern that fill()
+   writes for SEED. */
+static void
+check (const char *what, const uint8_t *p, size_t size, unsigned seed)
+{
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    if (p[i] != (uint8_t) (i * 7 + seed))
+      fail ("%s of %zu bytes: byte %zu is wrong", what, size, i);
+}
+
+void
+test_memcpy_bench (void)
+{
+  uint8_t *src = palloc_get_multiple (0, BUF_PAGES);
+  uint8_t *dst = palloc_get_multiple (0, BUF_PAGES);
+  size_t i, j;
+
+  if (src == NULL || dst == NULL)
+    fail ("cannot allocate %d pages for the buffers", BUF_PAGES * 2);
+
+  for (i = 0; i < SIZE_CNT; i++)
+    {
+      size_t size = sizes[i];
+      size_t iters = BYTES_PER_SIZE / size;
+      size_t move_size = size < BUF_SIZE ? size : size - 8;
+      uint64_t start, copy, move, set, bytes;
+
+      fill (src, size, i);
+      start = rdtsc ();
+      for (j = 0; j < iters; j++)
+        memcpy (dst, src, size);
+      copy = rdtsc () - start;
+      check ("memcpy", dst, size, i);
+
+      start = rdtsc ();
+      for (j = 0; j < iters; j++)
+        byte_copy (dst, src, size);
+      bytes = rdtsc () - start;
+      check ("byte copy", dst, size, i);
+
+      start = rdtsc ();
+      for (j = 0; j < iters; j++)
+        memmove (dst + 8, dst, move_size);
+      move = rdtsc () - start;
+      memcpy (dst, src, size);
+      memmove (dst + 8, dst, move_size);
+      check ("memmove", dst + 8, move_size, i);
+
+      start = rdtsc ();
+      for (j = 0; j < iters; j++)
+        memset (dst, j, size);
+      set = rdtsc () - start;
+      for (j = 0; j < size; j++)
+        if (dst[j] != (uint8_t) (iters - 1))
+          fail ("memset of %zu bytes: byte %zu is wrong", size, j);
+
+      msg ("%zu bytes: memcpy %llu, memmove %llu, memset %llu, "
+           "byte loop %llu cycles per call", size,
+           (unsigned long long) (copy / iters),
+           (unsigned long long) (move / iters),
+           (unsigned long long) (set / iters),
+           (unsigned long long) (bytes / iters));
+    }
+
+  palloc_free_multiple (src, BUF_PAGES);
+  palloc_free_multiple (dst, BUF_PAGES);
+  pass ();
+}
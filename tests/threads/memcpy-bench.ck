@@ -0,0 +1,26 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+
+common_checks ("run", @output);
+
+@output = get_core_output ("run", @output);
+
+# The sizes are timed from smallest to largest, one line each.
+my (@sizes) = (8, 24, 64, 256, 1024, 4096, 65536, 2097152);
+my (@seen);
+foreach (@output) {
+    push (@seen, $1)
+      if /^\(memcpy-bench\) (\d+) bytes: memcpy \d+, memmove \d+, memset \d+, byte loop \d+ cycles per call$/;
+}
+
+fail "expected results for sizes @sizes, got @seen\n"
+  if "@seen" ne "@sizes";
+fail "missing PASS in output\n"
+  unless grep ($_ eq '(memcpy-bench) PASS', @output);
+
+pass;
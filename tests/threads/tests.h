@@ -32,6 +32,9 @@ extern test_func test_mlfqs_fair_20;
 extern test_func test_mlfqs_nice_2;
 extern test_func test_mlfqs_nice_10;
 extern test_func test_mlfqs_block;
+extern test_func test_malloc_bench;
+extern test_func test_bitmap_bench;
+extern test_func test_memcpy_bench;
 
 void msg (const char *, ...);
 void fail (const char *, ...);
@@ -1,8 +1,10 @@
 #include "threads/init.h"
 #include <console.h>
 #include <debug.h>
+#include <inttypes.h>
 #include <limits.h>
 #include <random.h>
+#include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -17,10 +19,12 @@
 #include "threads/io.h"
 #include "threads/loader.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
 #include "threads/mmu.h"
 #include "threads/palloc.h"
 #include "threads/pte.h"
 #include "threads/thread.h"
+#include "intrinsic.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #include "userprog/exception.h"
@@ -36,6 +40,7 @@
 #include "devices/disk.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
+#include "filesys/page_cache.h"
 #endif
 
 /* Page-map-level-4 with kernel mappings only. */
@@ -51,6 +56,16 @@ bool power_off_when_done;
 
 bool thread_tests;
 
+/* -kmap: Largest page size for the kernel's map of physical memory. */
+enum kmap_size { KMAP_4K, KMAP_2M, KMAP_1G };
+static enum kmap_size kmap_size = KMAP_1G;
+static const char *kmap_names[] = { "4k", "2m", "1g" };
+
+/* Kernel map statistics. */
+static size_t kmap_tables;         /* Page-table pages allocated. */
+static size_t kmap_tables_4k;      /* ...that 4 kB pages would take. */
+static uint64_t kmap_cycles;       /* TSC cycles spent in paging_init. */
+
 static void bss_init (void);
 static void paging_init (uint64_t mem_end);
 
@@ -105,6 +120,7 @@ main (void) {
 	thread_start ();
 	serial_init_queue ();
 	timer_calibrate ();
+	palloc_start_zeroer ();
 
 #ifdef FILESYS
 	/* Initialize file system. */
@@ -140,31 +156,92 @@ bss_init (void) {
 	memset (&_start_bss, 0, &_end_bss - &_start_bss);
 }
 
+/* Returns entry IDX of TABLE, one level of the kernel map, if LAST.
+ * Otherwise returns the next-level table that entry points to,
+ * allocating a zeroed one if needed. */
+static uint64_t *
+kmap_descend (uint64_t *table, int idx, bool last) {
+	if (last)
+		return &table[idx];
+	if (!(table[idx] & PTE_P)) {
+		table[idx] = vtop (palloc_get_page (PAL_ASSERT | PAL_ZERO))
+			| PTE_P | PTE_W;
+		kmap_tables++;
+	}
+	return ptov (PTE_ADDR (table[idx]));
+}
+
+/* Returns true if the CPU supports 1 GiB pages. */
+static bool
+cpu_has_1g_pages (void) {
+	uint32_t a, b, c, d;
+
+	cpuid (0x80000000, &a, &b, &c, &d);
+	if (a < 0x80000001)
+		return false;
+	cpuid (0x80000001, &a, &b, &c, &d);
+	return (d & (1 << 26)) != 0;
+}
+
 /* Populates the page table with the kernel virtual mapping,
  * and then sets up the CPU to use the new page directory.
- * Points base_pml4 to the pml4 it creates. */
+ * Points base_pml4 to the pml4 it creates.
+ *
+ * Physical memory is mapped with the largest pages allowed by -kmap
+ * and the CPU.  The 2 MiB chunks that hold kernel text are mapped with
+ * 4 kB pages, so that the text stays read-only and the rest writable. */
 static void
 paging_init (uint64_t mem_end) {
 	uint64_t *pml4, *pte;
 	int perm;
+	uint64_t start_tsc = rdtsc ();
 	pml4 = base_pml4 = palloc_get_page (PAL_ASSERT | PAL_ZERO);
 
 	extern char start, _end_kernel_text;
+	uint64_t text_lo = vtop (&start) & ~(HUGE_PGSIZE - 1);
+	uint64_t text_hi = ROUND_UP (vtop (&_end_kernel_text), HUGE_PGSIZE);
+	bool use_1g = kmap_size == KMAP_1G && cpu_has_1g_pages ();
+	bool use_2m = kmap_size >= KMAP_2M;
+	const uint64_t gib = 1UL << PDPESHIFT;
+
 	// Maps physical address [0 ~ mem_end] to
 	//   [LOADER_KERN_BASE ~ LOADER_KERN_BASE + mem_end].
-	for (uint64_t pa = 0; pa < mem_end; pa += PGSIZE) {
+	for (uint64_t pa = 0; pa < mem_end; ) {
 		uint64_t va = (uint64_t) ptov(pa);
+		uint64_t *pdpt = kmap_descend (pml4, PML4 (va), false);
+
+		if (use_1g && va % gib == 0 && pa + gib <= mem_end
+				&& (pa + gib <= text_lo || pa >= text_hi)) {
+			*kmap_descend (pdpt, PDPE (va), true) = pa | PTE_PS | PTE_P | PTE_W;
+			pa += gib;
+			continue;
+		}
+		uint64_t *pd = kmap_descend (pdpt, PDPE (va), false);
+		if (use_2m && va % HUGE_PGSIZE == 0 && pa + HUGE_PGSIZE <= mem_end
+				&& (pa + HUGE_PGSIZE <= text_lo || pa >= text_hi)) {
+			*kmap_descend (pd, PDX (va), true) = pa | PTE_PS | PTE_P | PTE_W;
+			pa += HUGE_PGSIZE;
+			continue;
+		}
 
 		perm = PTE_P | PTE_W;
 		if ((uint64_t) &start <= va && va < (uint64_t) &_end_kernel_text)
 			perm &= ~PTE_W;
 
-		if ((pte = pml4e_walk (pml4, va, 1)) != NULL)
-			*pte = pa | perm;
+		pte = kmap_descend (kmap_descend (pd, PDX (va), false), PTX (va), true);
+		*pte = pa | perm;
+		pa += PGSIZE;
 	}
 
 	// reload cr3
 	pml4_activate(0);
+
+	/* A 4 kB map needs one page table per 2 MiB, one directory per
+	 * GiB of virtual space it touches, and a single PDPT. */
+	uint64_t va_lo = (uint64_t) ptov (0), va_hi = (uint64_t) ptov (mem_end);
+	kmap_tables_4k = DIV_ROUND_UP (mem_end, HUGE_PGSIZE)
+		+ (ROUND_UP (va_hi, gib) - (va_lo & ~(gib - 1))) / gib + 1;
+	kmap_cycles = rdtsc () - start_tsc;
 }
 
 /* Breaks the kernel command line into words and returns them as
@@ -216,9 +293,25 @@ parse_options (char **argv) {
 #ifdef FILESYS
 		else if (!strcmp (name, "-f"))
 			format_filesys = true;
+#endif
+#ifdef EFILESYS
+		else if (!strcmp (name, "-cluster")) {
+			fat_format_cluster = value != NULL ? atoi (value) : 0;
+			if (fat_format_cluster < 1 || fat_format_cluster > 64)
+				PANIC ("cluster size must be 1 to 64 sectors");
+		}
 #endif
 		else if (!strcmp (name, "-rs"))
 			random_init (atoi (value));
+		else if (!strcmp (name, "-kmap")) {
+			size_t i;
+			for (i = 0; i < sizeof kmap_names / sizeof *kmap_names; i++)
+				if (value != NULL && !strcmp (value, kmap_names[i]))
+					break;
+			if (i == sizeof kmap_names / sizeof *kmap_names)
+				PANIC ("unknown kernel map page size `%s'", value);
+			kmap_size = i;
+		}
 		else if (!strcmp (name, "-mlfqs"))
 			thread_mlfqs = true;
 #ifdef USERPROG
@@ -226,6 +319,16 @@ parse_options (char **argv) {
 			user_page_limit = atoi (value);
 		else if (!strcmp (name, "-threads-tests"))
 			thread_tests = true;
+#endif
+#ifdef VM
+		else if (!strcmp (name, "-evict")) {
+			if (!vm_set_evict_policy (value))
+				PANIC ("unknown eviction policy `%s'", value);
+		}
+		else if (!strcmp (name, "-fault-around"))
+			vm_fault_around = atoi (value);
+		else if (!strcmp (name, "-huge-pages"))
+			vm_huge_pages = true;
 #endif
 		else
 			PANIC ("unknown option `%s' (use -h for help)", name);
@@ -324,10 +427,19 @@ usage (void) {
 			"  -h                 Print this help message and power off.\n"
 			"  -q                 Power off VM after actions or on panic.\n"
 			"  -f                 Format file system disk during startup.\n"
+#ifdef EFILESYS
+			"  -cluster=N         Format with N sectors per cluster (1-64, default 1).\n"
+#endif
 			"  -rs=SEED           Set random number seed to SEED.\n"
+			"  -kmap=SIZE         Kernel map page size: 4k, 2m or 1g.\n"
 			"  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
 			"  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+			"  -evict=POLICY      Frame eviction: fifo, clock or eclock.\n"
+			"  -fault-around=N    Load up to N pages of a segment per fault.\n"
+			"  -huge-pages        Map aligned 2 MiB regions with huge pages.\n"
 #endif
 			);
 	power_off ();
@@ -352,14 +464,24 @@ power_off (void) {
 /* Print statistics about Pintos execution. */
 static void
 print_stats (void) {
+	printf ("Kernel map: %zu page-table pages (%zu saved), "
+			"%"PRIu64" cycles to build\n", kmap_tables,
+			kmap_tables_4k > kmap_tables ? kmap_tables_4k - kmap_tables : 0,
+			kmap_cycles);
 	timer_print_stats ();
 	thread_print_stats ();
 #ifdef FILESYS
 	disk_print_stats ();
+	page_cache_print_stats ();
 #endif
 	console_print_stats ();
 	kbd_print_stats ();
+	palloc_print_stats ();
+	slab_print_stats ();
 #ifdef USERPROG
 	exception_print_stats ();
 #endif
+#ifdef VM
+	vm_print_stats ();
+#endif
 }
@@ -7,6 +7,7 @@
 #include <string.h>
 #include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* A simple implementation of malloc().
@@ -32,7 +33,21 @@
    because they're too big to fit in a single page with a
    descriptor.  We handle those by allocating contiguous pages
    with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
+   the beginning of the allocated block's arena header.
+
+   The descriptor for a size is found by looking it up in a table
+   indexed by the size in 16-byte units, rather than by trying
+   each descriptor in turn.
+
+   Each thread also keeps a "magazine" of free blocks per
+   descriptor: a short stack linked through the blocks
+   themselves.  malloc() pops a block from the running thread's
+   magazine and free() pushes one onto it, so neither takes the
+   descriptor's lock nor touches its free list.  Only when a
+   magazine runs empty or full is a batch of blocks moved between
+   it and the descriptor, under the lock.  A block in a magazine
+   still counts as in use for its arena.  A thread's magazines
+   are emptied when it exits. */
 
 /* Descriptor. */
 struct desc {
@@ -61,6 +76,17 @@ struct block {
 static struct desc descs[10];   /* Descriptors. */
 static size_t desc_cnt;         /* Number of descriptors. */
 
+/* Largest block size handled by a descriptor. */
+#define MAX_BLOCK (PGSIZE / 4)
+
+/* Index into descs[] of the descriptor for each size, in units of
+   16 bytes rounded up. */
+static uint8_t size_class[MAX_BLOCK / 16 + 1];
+
+/* Blocks a magazine holds at most, and moves at once. */
+#define MAGAZINE_SIZE 16
+#define MAGAZINE_BATCH (MAGAZINE_SIZE / 2)
+
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
 
@@ -77,6 +103,99 @@ malloc_init (void) {
 		list_init (&d->free_list);
 		lock_init (&d->lock);
 	}
+	ASSERT (desc_cnt == MALLOC_CLASS_CNT);
+	ASSERT (descs[desc_cnt - 1].block_size == MAX_BLOCK);
+
+	for (size_t i = 0, c = 0; i <= MAX_BLOCK / 16; i++) {
+		while (descs[c].block_size < i * 16)
+			c++;
+		size_class[i] = c;
+	}
+}
+
+/* Moves up to MAGAZINE_BATCH blocks from descriptor D to magazine
+   M, creating a new arena if D has none free.  Returns false if
+   no block could be obtained. */
+static bool
+magazine_refill (struct desc *d, struct malloc_magazine *m) {
+	lock_acquire (&d->lock);
+
+	/* If the free list is empty, create a new arena. */
+	if (list_empty (&d->free_list)) {
+		struct arena *a;
+		size_t i;
+
+		/* Allocate a page. */
+		a = palloc_get_page (0);
+		if (a == NULL) {
+			lock_release (&d->lock);
+			return false;
+		}
+
+		/* Initialize arena and add its blocks to the free list. */
+		a->magic = ARENA_MAGIC;
+		a->desc = d;
+		a->free_cnt = d->blocks_per_arena;
+		for (i = 0; i < d->blocks_per_arena; i++) {
+			struct block *b = arena_to_block (a, i);
+			list_push_back (&d->free_list, &b->free_elem);
+		}
+	}
+
+	/* Move blocks from the free list to the magazine. */
+	while (m->cnt < MAGAZINE_BATCH && !list_empty (&d->free_list)) {
+		struct block *b = list_entry (list_pop_front (&d->free_list),
+				struct block, free_elem);
+		block_to_arena (b)->free_cnt--;
+		*(void **) b = m->top;
+		m->top = b;
+		m->cnt++;
+	}
+	lock_release (&d->lock);
+	return true;
+}
+
+/* Moves CNT blocks from magazine M back to descriptor D, giving
+   arenas left entirely unused back to the page allocator. */
+static void
+magazine_drain (struct desc *d, struct malloc_magazine *m, size_t cnt) {
+	ASSERT (cnt <= m->cnt);
+
+	lock_acquire (&d->lock);
+	for (; cnt > 0; cnt--) {
+		struct block *b = m->top;
+		struct arena *a = block_to_arena (b);
+
+		m->top = *(void **) b;
+		m->cnt--;
+
+		/* Add block to free list. */
+		list_push_front (&d->free_list, &b->free_elem);
+
+		/* If the arena is now entirely unused, free it. */
+		if (++a->free_cnt >= d->blocks_per_arena) {
+			size_t i;
+
+			ASSERT (a->free_cnt == d->blocks_per_arena);
+			for (i = 0; i < d->blocks_per_arena; i++) {
+				struct block *b = arena_to_block (a, i);
+				list_remove (&b->free_elem);
+			}
+			palloc_free_page (a);
+		}
+	}
+	lock_release (&d->lock);
+}
+
+/* Gives the blocks in the running thread's magazines back to
+   their descriptors.  Called when a thread exits. */
+void
+malloc_flush (void) {
+	struct malloc_magazine *mags = thread_current ()->magazines;
+
+	for (size_t i = 0; i < desc_cnt; i++)
+		if (mags[i].cnt > 0)
+			magazine_drain (&descs[i], &mags[i], mags[i].cnt);
 }
 
 /* Obtains and returns a new block of at least SIZE bytes.
@@ -84,6 +203,7 @@ malloc_init (void) {
 void *
 malloc (size_t size) {
 	struct desc *d;
+	struct malloc_magazine *m;
 	struct block *b;
 	struct arena *a;
 
@@ -91,12 +211,7 @@ malloc (size_t size) {
 	if (size == 0)
 		return NULL;
 
-	/* Find the smallest descriptor that satisfies a SIZE-byte
-	   request. */
-	for (d = descs; d < descs + desc_cnt; d++)
-		if (d->block_size >= size)
-			break;
-	if (d == descs + desc_cnt) {
+	if (size > MAX_BLOCK) {
 		/* SIZE is too big for any descriptor.
 		   Allocate enough pages to hold SIZE plus an arena. */
 		size_t page_cnt = DIV_ROUND_UP (size + sizeof *a, PGSIZE);
@@ -112,34 +227,18 @@ malloc (size_t size) {
 		return a + 1;
 	}
 
-	lock_acquire (&d->lock);
-
-	/* If the free list is empty, create a new arena. */
-	if (list_empty (&d->free_list)) {
-		size_t i;
-
-		/* Allocate a page. */
-		a = palloc_get_page (0);
-		if (a == NULL) {
-			lock_release (&d->lock);
-			return NULL;
-		}
-
-		/* Initialize arena and add its blocks to the free list. */
-		a->magic = ARENA_MAGIC;
-		a->desc = d;
-		a->free_cnt = d->blocks_per_arena;
-		for (i = 0; i < d->blocks_per_arena; i++) {
-			struct block *b = arena_to_block (a, i);
-			list_push_back (&d->free_list, &b->free_elem);
-		}
-	}
+	/* Find the smallest descriptor that satisfies a SIZE-byte
+	   request. */
+	d = &descs[size_class[DIV_ROUND_UP (size, 16)]];
 
-	/* Get a block from free list and return it. */
-	b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
-	a = block_to_arena (b);
-	a->free_cnt--;
-	lock_release (&d->lock);
+	/* Take a block from the running thread's magazine, refilling
+	   it from the descriptor if it is empty. */
+	m = &thread_current ()->magazines[d - descs];
+	if (m->cnt == 0 && !magazine_refill (d, m))
+		return NULL;
+	b = m->top;
+	m->top = *(void **) b;
+	m->cnt--;
 	return b;
 }
 
@@ -207,30 +306,21 @@ free (void *p) {
 
 		if (d != NULL) {
 			/* It's a normal block.  We handle it here. */
+			struct malloc_magazine *m =
+				&thread_current ()->magazines[d - descs];
 
 #ifndef NDEBUG
 			/* Clear the block to help detect use-after-free bugs. */
 			memset (b, 0xcc, d->block_size);
 #endif
 
-			lock_acquire (&d->lock);
-
-			/* Add block to free list. */
-			list_push_front (&d->free_list, &b->free_elem);
-
-			/* If the arena is now entirely unused, free it. */
-			if (++a->free_cnt >= d->blocks_per_arena) {
-				size_t i;
-
-				ASSERT (a->free_cnt == d->blocks_per_arena);
-				for (i = 0; i < d->blocks_per_arena; i++) {
-					struct block *b = arena_to_block (a, i);
-					list_remove (&b->free_elem);
-				}
-				palloc_free_page (a);
-			}
-
-			lock_release (&d->lock);
+			/* Make room in the running thread's magazine if it is
+			   full, then cache the block there. */
+			if (m->cnt >= MAGAZINE_SIZE)
+				magazine_drain (d, m, MAGAZINE_BATCH);
+			*(void **) b = m->top;
+			m->top = b;
+			m->cnt++;
 		} else {
 			/* It's a big block.  Free its pages. */
 			palloc_free_multiple (a, a->free_cnt);
@@ -238,7 +328,7 @@ free (void *p) {
 		}
 	}
 }
-
+
 /* Returns the arena that block B is inside. */
 static struct arena *
 block_to_arena (struct block *b) {
@@ -2,17 +2,75 @@
 #include <stddef.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
 #include "intrinsic.h"
 
+/* Page tables set aside for splitting huge pages, at least one for
+ * each huge page mapped, so that unmapping part of one never has to
+ * allocate.  Linked through their first entry. */
+static uint64_t *split_reserve;
+
+/* Adds page table PT to the split reserve. */
+static void
+reserve_push (uint64_t *pt) {
+	enum intr_level old_level = intr_disable ();
+	*(uint64_t **) pt = split_reserve;
+	split_reserve = pt;
+	intr_set_level (old_level);
+}
+
+/* Takes a page table from the split reserve, or returns a null
+ * pointer if it is empty. */
+static uint64_t *
+reserve_pop (void) {
+	enum intr_level old_level = intr_disable ();
+	uint64_t *pt = split_reserve;
+	if (pt != NULL)
+		split_reserve = *(uint64_t **) pt;
+	intr_set_level (old_level);
+	return pt;
+}
+
+/* Replaces the 2 MiB mapping in *PDE by a page table mapping the same
+ * frames with the same permissions, accessed and dirty bits, so that
+ * they can be changed one 4 kB page at a time.  Returns false, leaving
+ * *PDE alone, if no page table could be had. */
+static bool
+pde_split (uint64_t *pde) {
+	uint64_t *pt = reserve_pop ();
+	uint64_t flags = *pde & (PTE_P | PTE_W | PTE_U | PTE_A | PTE_D);
+	uint64_t pa = PTE_ADDR (*pde);
+
+	ASSERT (*pde & PTE_PS);
+	if (pt == NULL)
+		pt = palloc_get_page (0);
+	if (pt == NULL)
+		return false;
+	for (unsigned i = 0; i < HUGE_PGCNT; i++)
+		pt[i] = (pa + i * PGSIZE) | flags;
+	*pde = vtop (pt) | PTE_U | PTE_W | PTE_P;
+	return true;
+}
+
+/* A huge page's directory entry stands in for its page table entries:
+ * looking one up without CREATE returns the PDE, so the accessed and
+ * dirty bits and the mapping apply to the whole 2 MiB.  With CREATE
+ * the huge page is split first. */
 static uint64_t *
 pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 	int idx = PDX (va);
 	if (pdp) {
 		uint64_t *pte = (uint64_t *) pdp[idx];
+		if (((uint64_t) pte & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS)) {
+			if (!create)
+				return &pdp[idx];
+			if (!pde_split (&pdp[idx]))
+				return NULL;
+		}
 		if (!((uint64_t) pte & PTE_P)) {
 			if (create) {
 				uint64_t *new_page = palloc_get_page (PAL_ZERO);
@@ -122,7 +180,13 @@ pgdir_for_each (uint64_t *pdp, pte_for_each_func *func, void *aux,
 		unsigned pml4_index, unsigned pdp_index) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
+		if ((pdp[i] & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS)) {
+			void *va = (void *) (((uint64_t) pml4_index << PML4SHIFT) |
+								 ((uint64_t) pdp_index << PDPESHIFT) |
+								 ((uint64_t) i << PDXSHIFT));
+			if (!func (&pdp[i], va, aux))
+				return false;
+		} else if (((uint64_t) pte) & PTE_P)
 			if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,
 					pml4_index, pdp_index, i))
 				return false;
@@ -135,7 +199,13 @@ pdp_for_each (uint64_t *pdp,
 		pte_for_each_func *func, void *aux, unsigned pml4_index) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pde = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pde) & PTE_P)
+		if ((pdp[i] & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS)) {
+			/* A 1 GiB page in the kernel's map. */
+			void *va = (void *) (((uint64_t) pml4_index << PML4SHIFT) |
+								 ((uint64_t) i << PDPESHIFT));
+			if (!func (&pdp[i], va, aux))
+				return false;
+		} else if (((uint64_t) pde) & PTE_P)
 			if (!pgdir_for_each ((uint64_t *) PTE_ADDR (pde), func,
 					 aux, pml4_index, i))
 				return false;
@@ -165,11 +235,17 @@ pt_destroy (uint64_t *pt) {
 	palloc_free_page ((void *) pt);
 }
 
+/* Huge pages have no page table; their frames belong to the VM.
+ * Each gives back the page table reserved for splitting it. */
 static void
 pgdir_destroy (uint64_t *pdp) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
+		if (!(((uint64_t) pte) & PTE_P))
+			continue;
+		if (pdp[i] & PTE_PS)
+			palloc_free_page (reserve_pop ());
+		else
 			pt_destroy (PTE_ADDR (pte));
 	}
 	palloc_free_page ((void *) pdp);
@@ -216,6 +292,9 @@ pml4_get_page (uint64_t *pml4, const void *uaddr) {
 
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) uaddr, 0);
 
+	if (pte && (*pte & PTE_P) && (*pte & PTE_PS))
+		return ptov (PTE_ADDR (*pte))
+			+ ((uint64_t) uaddr & (HUGE_PGSIZE - 1));
 	if (pte && (*pte & PTE_P))
 		return ptov (PTE_ADDR (*pte)) + pg_ofs (uaddr);
 	return NULL;
@@ -243,6 +322,59 @@ pml4_set_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
 	return pte != NULL;
 }
 
+/* Maps the 2 MiB of user virtual memory at UPAGE to the 2 MiB of
+ * physically contiguous frames at KPAGE with a single page directory
+ * entry.  Both must be 2 MiB aligned, and nothing in the range may be
+ * mapped yet.  A page table is put in the split reserve for the
+ * mapping; an empty one left there serves.  Returns true if
+ * successful, false if memory allocation failed or part of the range
+ * is mapped. */
+bool
+pml4_set_huge_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
+	uint64_t *pdpe, *pd, *pde;
+	uint64_t va = (uint64_t) upage;
+
+	ASSERT (huge_round_down (upage) == upage);
+	ASSERT (huge_round_down (kpage) == kpage);
+	ASSERT (is_user_vaddr (upage));
+	ASSERT (pml4 != base_pml4);
+
+	/* Make sure the page directory exists, then look at its entry. */
+	if (pml4e_walk (pml4, va, 1) == NULL)
+		return false;
+	pdpe = ptov (PTE_ADDR (pml4[PML4 (va)]));
+	pd = ptov (PTE_ADDR (pdpe[PDPE (va)]));
+	pde = &pd[PDX (va)];
+
+	uint64_t *pt = NULL;
+	if (*pde & PTE_P) {
+		if (*pde & PTE_PS)
+			return false;
+		pt = ptov (PTE_ADDR (*pde));
+		for (unsigned i = 0; i < HUGE_PGCNT; i++)
+			if (pt[i] & PTE_P)
+				return false;
+	} else {
+		pt = palloc_get_page (0);
+		if (pt == NULL)
+			return false;
+	}
+	reserve_push (pt);
+	*pde = vtop (kpage) | PTE_PS | PTE_P | (rw ? PTE_W : 0) | PTE_U;
+	return true;
+}
+
+/* Returns the page table entry for UPAGE in PML4, splitting the huge
+ * page that covers it, if any, so that it can be changed alone. */
+static uint64_t *
+pte_walk_split (uint64_t *pml4, const void *upage) {
+	uint64_t *pte = pml4e_walk (pml4, (uint64_t) upage, false);
+
+	if (pte != NULL && (*pte & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS))
+		pte = pml4e_walk (pml4, (uint64_t) upage, true);
+	return pte;
+}
+
 /* Marks user virtual page UPAGE "not present" in page
  * directory PD.  Later accesses to the page will fault.  Other
  * bits in the page table entry are preserved.
@@ -253,7 +385,7 @@ pml4_clear_page (uint64_t *pml4, void *upage) {
 	ASSERT (pg_ofs (upage) == 0);
 	ASSERT (is_user_vaddr (upage));
 
-	pte = pml4e_walk (pml4, (uint64_t) upage, false);
+	pte = pte_walk_split (pml4, upage);
 
 	if (pte != NULL && (*pte & PTE_P) != 0) {
 		*pte &= ~PTE_P;
@@ -276,7 +408,7 @@ pml4_is_dirty (uint64_t *pml4, const void *vpage) {
  * in PML4. */
 void
 pml4_set_dirty (uint64_t *pml4, const void *vpage, bool dirty) {
-	uint64_t *pte = pml4e_walk (pml4, (uint64_t) vpage, false);
+	uint64_t *pte = pte_walk_split (pml4, vpage);
 	if (pte) {
 		if (dirty)
 			*pte |= PTE_D;
@@ -288,6 +420,22 @@ pml4_set_dirty (uint64_t *pml4, const void *vpage, bool dirty) {
 	}
 }
 
+/* Sets the writable bit to WRITABLE in the PTE for virtual page VPAGE
+ * in PML4, leaving the accessed and dirty bits alone. */
+void
+pml4_set_writable (uint64_t *pml4, const void *vpage, bool writable) {
+	uint64_t *pte = pte_walk_split (pml4, vpage);
+	if (pte) {
+		if (writable)
+			*pte |= PTE_W;
+		else
+			*pte &= ~(uint64_t) PTE_W;
+
+		if (rcr3 () == vtop (pml4))
+			invlpg ((uint64_t) vpage);
+	}
+}
+
 /* Returns true if the PTE for virtual page VPAGE in PML4 has been
  * accessed recently, that is, between the time the PTE was
  * installed and the last time it was cleared.  Returns false if
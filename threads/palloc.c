@@ -9,7 +9,9 @@
 #include <string.h>
 #include "threads/init.h"
 #include "threads/loader.h"
+#include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* Page allocator.  Hands out memory in page-size (or
@@ -24,13 +26,77 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Within a pool, free pages are kept by a binary buddy allocator.
+   A free block of order K is 2**K pages aligned to 2**K pages in
+   physical memory, and sits on the pool's free list for order K.
+   A request for N pages takes the first block from the list of
+   the smallest order that fits, splitting a bigger block in
+   halves as needed, and gives the unused tail back.  A freed
+   block is merged with its "buddy", the other half of the block
+   it was split from, for as long as the buddy is free too.  Both
+   take O(log n) steps, however fragmented the pool is.
+
+   The free lists are linked through an array with an entry per
+   page, placed next to the pool's bitmap, rather than through
+   the free pages themselves.  The bitmap still records which
+   pages are in use.
+
+   A pool is protected by disabling interrupts rather than by a
+   lock, since the scheduler frees the pages of dying threads
+   where it cannot block.  The buddy operations are short enough
+   for that.
+
+   Most PAL_ZERO requests are for a single page: a thread, a page
+   table, a user stack.  Rather than clear those on the spot, each
+   pool keeps a stock of up to ZERO_TARGET pages that were cleared
+   in advance by the "zeroer" thread, which runs at PRI_MIN and so
+   only when nothing else wants the CPU.  Such a request takes a
+   page from the stock when there is one, and the zeroer is woken
+   when the stock runs low.  The stock is linked through the
+   pages' entries in the buddy array, as the pages themselves must
+   stay zero, and its pages count as used in the bitmap.  They are
+   handed out for other requests too if the pool runs out. */
+
+/* Largest block order.  Blocks of 2**MAX_ORDER pages are never
+   merged further. */
+#define MAX_ORDER 20
+
+/* End of a free list. */
+#define NIL UINT32_MAX
+
+/* The zeroer fills a pool's stock of zeroed pages up to
+   ZERO_TARGET and is woken once it drops below ZERO_LOW. */
+#define ZERO_TARGET 32
+#define ZERO_LOW 16
+
+/* Buddy allocator state of a page. */
+struct buddy {
+	uint32_t prev, next;            /* Free list neighbours, or NIL. */
+	int8_t order;                   /* Order if first of a free block,
+	                                   otherwise -1. */
+};
 
 /* A memory pool. */
 struct pool {
-	struct lock lock;               /* Mutual exclusion. */
 	struct bitmap *used_map;        /* Bitmap of free pages. */
 	uint8_t *base;                  /* Base of pool. */
+	size_t base_pfn;                /* Physical page number of BASE. */
+	struct buddy *buddies;          /* One entry per page. */
+	uint32_t free_list[MAX_ORDER + 1]; /* First free block per order. */
+	uint32_t zero_list;             /* First pre-zeroed page. */
+	size_t zero_cnt;                /* Number of pre-zeroed pages. */
+
+	/* Statistics. */
+	size_t free_cnt[MAX_ORDER + 1]; /* Free blocks per order. */
+	long long allocs;               /* Successful allocations. */
+	long long splits;               /* Blocks split in halves. */
+	long long merges;               /* Blocks merged with buddies. */
+	long long zero_hits;            /* PAL_ZERO requests served from
+	                                   the stock... */
+	long long zero_misses;          /* ...and cleared on the spot. */
+	long long zeroed;               /* Pages cleared by the zeroer. */
 };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -38,10 +104,19 @@ static struct pool kernel_pool, user_pool;
 
 /* Maximum number of pages to put in user pool. */
 size_t user_page_limit = SIZE_MAX;
+
+/* Upped to wake the zeroer, which waits on it only when
+   ZEROER_WAITING is true. */
+static struct semaphore zeroer_sema;
+static bool zeroer_waiting;
 static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end);
 
 static bool page_from_pool (const struct pool *, void *page);
+static void buddy_release (struct pool *, size_t page_idx, size_t page_cnt);
+static size_t buddy_claim (struct pool *, size_t page_cnt, int min_order);
+static size_t zero_pop (struct pool *);
+static void zero_push (struct pool *, size_t page_idx);
 
 /* multiboot info */
 struct multiboot_info {
@@ -224,11 +299,13 @@ split:
 			if ((uint64_t) pool_end < end) {
 				page_cnt = ((uint64_t) pool_end - start) / PGSIZE;
 				bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+				buddy_release (pool, page_idx, page_cnt);
 				start = (uint64_t) pool_end;
 				goto split;
 			} else {
 				page_cnt = ((uint64_t) end - start) / PGSIZE;
 				bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+				buddy_release (pool, page_idx, page_cnt);
 			}
 		}
 	}
@@ -250,9 +327,55 @@ palloc_init (void) {
 	printf ("\text_mem: 0x%llx ~ 0x%llx (Usable: %'llu kB)\n",
 		  ext_mem.start, ext_mem.end, ext_mem.size / 1024);
 	populate_pools (&base_mem, &ext_mem);
+	sema_init (&zeroer_sema, 0);
 	return ext_mem.end;
 }
 
+/* Keeps each pool's stock of zeroed pages filled, clearing pages
+   while nothing else is running. */
+static void
+zeroer (void *aux UNUSED) {
+	for (;;) {
+		struct pool *pools[] = { &kernel_pool, &user_pool };
+		struct pool *pool = NULL;
+		size_t page_idx = BITMAP_ERROR;
+		enum intr_level old_level;
+		size_t i;
+
+		old_level = intr_disable ();
+		for (i = 0; i < sizeof pools / sizeof *pools; i++)
+			if (pools[i]->zero_cnt < ZERO_TARGET) {
+				page_idx = buddy_claim (pools[i], 1, 0);
+				if (page_idx != BITMAP_ERROR) {
+					pool = pools[i];
+					break;
+				}
+			}
+		if (pool == NULL) {
+			/* Every stock is full, or its pool is out of pages. */
+			zeroer_waiting = true;
+			intr_set_level (old_level);
+			sema_down (&zeroer_sema);
+			continue;
+		}
+		intr_set_level (old_level);
+
+		memset (pool->base + PGSIZE * page_idx, 0, PGSIZE);
+
+		old_level = intr_disable ();
+		zero_push (pool, page_idx);
+		pool->zeroed++;
+		intr_set_level (old_level);
+	}
+}
+
+/* Starts the thread that clears pages in advance for PAL_ZERO
+   requests.  Must be called after thread_start(). */
+void
+palloc_start_zeroer (void) {
+	thread_create ("zeroer", PRI_MIN, zeroer, NULL);
+}
+
 /* Obtains and returns a group of PAGE_CNT contiguous free pages.
    If PAL_USER is set, the pages are obtained from the user pool,
    otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
@@ -262,10 +385,28 @@ palloc_init (void) {
 void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
 	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	size_t page_idx = BITMAP_ERROR;
+	bool zeroed = false;
 
-	lock_acquire (&pool->lock);
-	size_t page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-	lock_release (&pool->lock);
+	enum intr_level old_level = intr_disable ();
+	if (page_cnt == 1 && (flags & PAL_ZERO)) {
+		page_idx = zero_pop (pool);
+		zeroed = page_idx != BITMAP_ERROR;
+	}
+	if (page_idx == BITMAP_ERROR)
+		page_idx = buddy_claim (pool, page_cnt, 0);
+	if (page_idx == BITMAP_ERROR && page_cnt == 1) {
+		/* Out of free pages, but the stock may have some. */
+		page_idx = zero_pop (pool);
+		zeroed = page_idx != BITMAP_ERROR;
+	}
+	if (flags & PAL_ZERO) {
+		if (zeroed)
+			pool->zero_hits++;
+		else
+			pool->zero_misses++;
+	}
+	intr_set_level (old_level);
 	void *pages;
 
 	if (page_idx != BITMAP_ERROR)
@@ -273,6 +414,39 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
 	else
 		pages = NULL;
 
+	if (pages) {
+		if ((flags & PAL_ZERO) && !zeroed)
+			memset (pages, 0, PGSIZE * page_cnt);
+	} else {
+		if (flags & PAL_ASSERT)
+			PANIC ("palloc_get: out of pages");
+	}
+
+	return pages;
+}
+
+/* Like palloc_get_multiple(), but the first page is aligned to
+   a multiple of ALIGN pages in physical memory, as needed for
+   huge page mappings.  ALIGN must be a power of two. */
+void *
+palloc_get_aligned (enum palloc_flags flags, size_t page_cnt, size_t align) {
+	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	enum intr_level old_level;
+	size_t page_idx;
+	void *pages = NULL;
+	int order = 0;
+
+	ASSERT (align != 0 && (align & (align - 1)) == 0);
+
+	/* Buddy blocks are aligned to their own size. */
+	while (((size_t) 1 << order) < align)
+		order++;
+	old_level = intr_disable ();
+	page_idx = buddy_claim (pool, page_cnt, order);
+	intr_set_level (old_level);
+	if (page_idx != BITMAP_ERROR)
+		pages = pool->base + PGSIZE * page_idx;
+
 	if (pages) {
 		if (flags & PAL_ZERO)
 			memset (pages, 0, PGSIZE * page_cnt);
@@ -300,6 +474,7 @@ palloc_get_page (enum palloc_flags flags) {
 void
 palloc_free_multiple (void *pages, size_t page_cnt) {
 	struct pool *pool;
+	enum intr_level old_level;
 	size_t page_idx;
 
 	ASSERT (pg_ofs (pages) == 0);
@@ -318,8 +493,11 @@ palloc_free_multiple (void *pages, size_t page_cnt) {
 #ifndef NDEBUG
 	memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
+	old_level = intr_disable ();
 	ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
 	bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+	buddy_release (pool, page_idx, page_cnt);
+	intr_set_level (old_level);
 }
 
 /* Frees the page at PAGE. */
@@ -328,6 +506,51 @@ palloc_free_page (void *page) {
 	palloc_free_multiple (page, 1);
 }
 
+/* Returns the kernel virtual address of the first page in the user
+ * pool and stores the number of pages it spans in *PAGE_CNT. */
+void *
+palloc_user_pool (size_t *page_cnt) {
+	*page_cnt = bitmap_size (user_pool.used_map);
+	return user_pool.base;
+}
+
+/* Prints the free blocks of POOL, named NAME, and how badly its
+   free memory is fragmented: the share of free pages that are not
+   in the largest free block. */
+static void
+print_pool_stats (const char *name, struct pool *pool) {
+	size_t free_pages = 0, largest = 0;
+	int order;
+
+	for (order = 0; order <= MAX_ORDER; order++)
+		if (pool->free_cnt[order] > 0) {
+			free_pages += pool->free_cnt[order] << order;
+			largest = (size_t) 1 << order;
+		}
+	printf ("%s pool: %zu of %zu pages free, largest block %zu pages, "
+			"%zu%% fragmented\n", name, free_pages,
+			bitmap_size (pool->used_map), largest,
+			free_pages ? (free_pages - largest) * 100 / free_pages : 0);
+	printf ("%s pool: %zu pages zeroed in advance, %lld of %lld PAL_ZERO "
+			"requests served from them, %lld pages zeroed by the zeroer\n",
+			name, pool->zero_cnt, pool->zero_hits,
+			pool->zero_hits + pool->zero_misses, pool->zeroed);
+	printf ("%s pool: %lld allocations, %lld splits, %lld merges; "
+			"free blocks by order:", name, pool->allocs, pool->splits,
+			pool->merges);
+	for (order = 0; order <= MAX_ORDER; order++)
+		if (pool->free_cnt[order] > 0)
+			printf (" %d:%zu", order, pool->free_cnt[order]);
+	printf ("\n");
+}
+
+/* Prints page allocator statistics. */
+void
+palloc_print_stats (void) {
+	print_pool_stats ("Kernel", &kernel_pool);
+	print_pool_stats ("User", &user_pool);
+}
+
 /* Initializes pool P as starting at START and ending at END */
 static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
@@ -336,15 +559,170 @@ init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
      and subtract it from the pool's size. */
 	uint64_t pgcnt = (end - start) / PGSIZE;
 	size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (pgcnt), PGSIZE) * PGSIZE;
+	size_t buddy_pages = DIV_ROUND_UP (pgcnt * sizeof *p->buddies, PGSIZE)
+		* PGSIZE;
+	size_t i;
+
+	ASSERT (pgcnt < NIL);
 
-	lock_init(&p->lock);
 	p->used_map = bitmap_create_in_buf (pgcnt, *bm_base, bm_pages);
 	p->base = (void *) start;
+	p->base_pfn = vtop (p->base) / PGSIZE;
 
 	// Mark all to unusable.
 	bitmap_set_all(p->used_map, true);
 
 	*bm_base += bm_pages;
+
+	/* No free blocks until populate_pools() finds usable memory. */
+	p->buddies = *bm_base;
+	for (i = 0; i < pgcnt; i++)
+		p->buddies[i] = (struct buddy) { NIL, NIL, -1 };
+	for (i = 0; i <= MAX_ORDER; i++) {
+		p->free_list[i] = NIL;
+		p->free_cnt[i] = 0;
+	}
+	p->zero_list = NIL;
+	p->zero_cnt = 0;
+	p->allocs = p->splits = p->merges = 0;
+	p->zero_hits = p->zero_misses = p->zeroed = 0;
+
+	*bm_base += buddy_pages;
+}
+
+/* Adds the free block of ORDER at page PAGE_IDX of POOL to its free
+   list. */
+static void
+buddy_push (struct pool *pool, size_t page_idx, int order) {
+	struct buddy *b = &pool->buddies[page_idx];
+	uint32_t head = pool->free_list[order];
+
+	b->order = order;
+	b->prev = NIL;
+	b->next = head;
+	if (head != NIL)
+		pool->buddies[head].prev = page_idx;
+	pool->free_list[order] = page_idx;
+	pool->free_cnt[order]++;
+}
+
+/* Takes the free block at page PAGE_IDX of POOL off its free list. */
+static void
+buddy_unlink (struct pool *pool, size_t page_idx) {
+	struct buddy *b = &pool->buddies[page_idx];
+
+	ASSERT (b->order >= 0);
+	if (b->prev != NIL)
+		pool->buddies[b->prev].next = b->next;
+	else
+		pool->free_list[b->order] = b->next;
+	if (b->next != NIL)
+		pool->buddies[b->next].prev = b->prev;
+	pool->free_cnt[b->order]--;
+	b->order = -1;
+}
+
+/* Frees the block of ORDER at page PAGE_IDX of POOL, merging it with
+   its buddy for as long as the buddy is free. */
+static void
+buddy_free (struct pool *pool, size_t page_idx, int order) {
+	size_t base_no = pool->base_pfn;
+	size_t page_cnt = bitmap_size (pool->used_map);
+
+	for (; order < MAX_ORDER; order++) {
+		size_t buddy_no = (base_no + page_idx) ^ ((size_t) 1 << order);
+		size_t buddy_idx = buddy_no - base_no;
+
+		if (buddy_no < base_no
+				|| buddy_idx + ((size_t) 1 << order) > page_cnt
+				|| pool->buddies[buddy_idx].order != order)
+			break;
+		buddy_unlink (pool, buddy_idx);
+		if (buddy_idx < page_idx)
+			page_idx = buddy_idx;
+		pool->merges++;
+	}
+	buddy_push (pool, page_idx, order);
+}
+
+/* Frees the PAGE_CNT pages at page PAGE_IDX of POOL, as the fewest
+   blocks that are aligned to their size. */
+static void
+buddy_release (struct pool *pool, size_t page_idx, size_t page_cnt) {
+	size_t base_no = pool->base_pfn;
+
+	while (page_cnt > 0) {
+		int order = 0;
+
+		while (order < MAX_ORDER
+				&& ((base_no + page_idx) & (((size_t) 2 << order) - 1)) == 0
+				&& ((size_t) 2 << order) <= page_cnt)
+			order++;
+		buddy_free (pool, page_idx, order);
+		page_idx += (size_t) 1 << order;
+		page_cnt -= (size_t) 1 << order;
+	}
+}
+
+/* Allocates PAGE_CNT pages from POOL, aligned to at least 2**MIN_ORDER
+   pages, and marks them used.  Returns the index of the first page,
+   or BITMAP_ERROR if no free block is big enough. */
+static size_t
+buddy_claim (struct pool *pool, size_t page_cnt, int min_order) {
+	int order = min_order, found;
+	size_t page_idx;
+
+	while (order <= MAX_ORDER && ((size_t) 1 << order) < page_cnt)
+		order++;
+	for (found = order; found <= MAX_ORDER; found++)
+		if (pool->free_list[found] != NIL)
+			break;
+	if (found > MAX_ORDER)
+		return BITMAP_ERROR;
+
+	/* Split the block found down to ORDER, freeing upper halves. */
+	page_idx = pool->free_list[found];
+	buddy_unlink (pool, page_idx);
+	while (found > order) {
+		found--;
+		buddy_push (pool, page_idx + ((size_t) 1 << found), found);
+		pool->splits++;
+	}
+
+	/* Give back the tail the request does not need. */
+	bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+	buddy_release (pool, page_idx + page_cnt,
+			((size_t) 1 << order) - page_cnt);
+	pool->allocs++;
+	return page_idx;
+}
+
+/* Adds page PAGE_IDX of POOL, which is allocated and filled with
+   zeros, to its stock of zeroed pages.  Interrupts must be off. */
+static void
+zero_push (struct pool *pool, size_t page_idx) {
+	pool->buddies[page_idx].next = pool->zero_list;
+	pool->zero_list = page_idx;
+	pool->zero_cnt++;
+}
+
+/* Takes a page from POOL's stock of zeroed pages and returns its
+   index, or BITMAP_ERROR if the stock is empty.  Wakes the zeroer
+   if the stock is running low.  Interrupts must be off. */
+static size_t
+zero_pop (struct pool *pool) {
+	size_t page_idx = pool->zero_list;
+
+	if (page_idx != NIL) {
+		pool->zero_list = pool->buddies[page_idx].next;
+		pool->buddies[page_idx].next = NIL;
+		pool->zero_cnt--;
+	}
+	if (pool->zero_cnt < ZERO_LOW && zeroer_waiting) {
+		zeroer_waiting = false;
+		sema_up (&zeroer_sema);
+	}
+	return page_idx != NIL ? page_idx : BITMAP_ERROR;
 }
 
 /* Returns true if PAGE was allocated from POOL,
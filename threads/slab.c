@@ -0,0 +1,174 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Object caches.
+
+   malloc() serves every size from a handful of power-of-2
+   descriptors, which wastes up to half of each block and has to
+   find the descriptor on every call.  A slab cache instead holds
+   objects of one type, packed into pages called "slabs".
+
+   Each slab starts with a header that counts its free objects
+   and links them into a list of their own, so an object is
+   freed into the slab it came from, found by rounding its
+   address down to the page.  The cache keeps the slabs that have
+   free objects on its partial list; allocation takes an object
+   from the first of them.  A slab whose objects are all free is
+   given back to the page allocator, unless it is the only one
+   with free objects left, so that a cache going up and down
+   around a slab boundary does not thrash the page allocator.
+
+   Objects are not constructed or cleared: the caller
+   initializes every object it allocates. */
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab0b1e
+
+/* Slab header, at the start of each slab page. */
+struct slab {
+	unsigned magic;             /* Always set to SLAB_MAGIC. */
+	struct slab_cache *cache;   /* Owning cache. */
+	struct list_elem elem;      /* Cache's partial list element. */
+	size_t free_cnt;            /* Number of free objects. */
+	void *free;                 /* First free object. */
+};
+
+/* Objects start this far into a slab. */
+#define SLAB_HEADER ROUND_UP (sizeof (struct slab), sizeof (void *) * 2)
+
+/* Every cache, for slab_print_stats(). */
+static struct slab_cache *caches[16];
+static size_t cache_cnt;
+
+/* Initializes CACHE to hold objects of OBJ_SIZE bytes.  NAME
+   appears in the statistics. */
+void
+slab_cache_init (struct slab_cache *cache, const char *name,
+		size_t obj_size) {
+	obj_size = ROUND_UP (obj_size < sizeof (void *)
+			? sizeof (void *) : obj_size, sizeof (void *));
+	ASSERT (obj_size <= PGSIZE - SLAB_HEADER);
+
+	cache->name = name;
+	cache->obj_size = obj_size;
+	cache->objs_per_slab = (PGSIZE - SLAB_HEADER) / obj_size;
+	list_init (&cache->partial);
+	lock_init (&cache->lock);
+	cache->slab_cnt = 0;
+	cache->in_use = cache->peak = 0;
+	cache->allocs = cache->frees = 0;
+
+	ASSERT (cache_cnt < sizeof caches / sizeof *caches);
+	caches[cache_cnt++] = cache;
+}
+
+/* Adds a new slab to CACHE's partial list.  Returns false if no
+   page is available. */
+static bool
+slab_grow (struct slab_cache *cache) {
+	struct slab *s = palloc_get_page (0);
+	uint8_t *obj;
+	size_t i;
+
+	if (s == NULL)
+		return false;
+	s->magic = SLAB_MAGIC;
+	s->cache = cache;
+	s->free_cnt = cache->objs_per_slab;
+	s->free = NULL;
+	obj = (uint8_t *) s + SLAB_HEADER + cache->objs_per_slab * cache->obj_size;
+	for (i = 0; i < cache->objs_per_slab; i++) {
+		obj -= cache->obj_size;
+		*(void **) obj = s->free;
+		s->free = obj;
+	}
+	list_push_front (&cache->partial, &s->elem);
+	cache->slab_cnt++;
+	return true;
+}
+
+/* Returns the slab holding object OBJ of CACHE. */
+static struct slab *
+obj_to_slab (struct slab_cache *cache, void *obj) {
+	struct slab *s = pg_round_down (obj);
+
+	ASSERT (s->magic == SLAB_MAGIC);
+	ASSERT (s->cache == cache);
+	ASSERT ((pg_ofs (obj) - SLAB_HEADER) % cache->obj_size == 0);
+	return s;
+}
+
+/* Obtains and returns a new, uninitialized object from CACHE.
+   Returns a null pointer if memory is not available. */
+void *
+slab_alloc (struct slab_cache *cache) {
+	struct slab *s;
+	void *obj;
+
+	lock_acquire (&cache->lock);
+	if (list_empty (&cache->partial) && !slab_grow (cache)) {
+		lock_release (&cache->lock);
+		return NULL;
+	}
+	s = list_entry (list_front (&cache->partial), struct slab, elem);
+	obj = s->free;
+	s->free = *(void **) obj;
+	if (--s->free_cnt == 0)
+		list_remove (&s->elem);
+	cache->allocs++;
+	if (++cache->in_use > cache->peak)
+		cache->peak = cache->in_use;
+	lock_release (&cache->lock);
+	return obj;
+}
+
+/* Frees OBJ, which must have been allocated from CACHE.  A null
+   OBJ is ignored. */
+void
+slab_free (struct slab_cache *cache, void *obj) {
+	struct slab *s;
+
+	if (obj == NULL)
+		return;
+	s = obj_to_slab (cache, obj);
+
+#ifndef NDEBUG
+	/* Clear the object to help detect use-after-free bugs. */
+	memset (obj, 0xcc, cache->obj_size);
+#endif
+
+	lock_acquire (&cache->lock);
+	*(void **) obj = s->free;
+	s->free = obj;
+	if (s->free_cnt++ == 0)
+		list_push_front (&cache->partial, &s->elem);
+	cache->frees++;
+	cache->in_use--;
+
+	/* Give an empty slab back, keeping one to allocate from. */
+	if (s->free_cnt == cache->objs_per_slab
+			&& list_begin (&cache->partial) != list_rbegin (&cache->partial)) {
+		list_remove (&s->elem);
+		cache->slab_cnt--;
+		s->magic = 0;
+		palloc_free_page (s);
+	}
+	lock_release (&cache->lock);
+}
+
+/* Prints statistics for every cache. */
+void
+slab_print_stats (void) {
+	for (size_t i = 0; i < cache_cnt; i++) {
+		struct slab_cache *c = caches[i];
+		printf ("Slab %s: %zu bytes, %zu in use (peak %zu) in %zu slabs, "
+				"%lld allocs, %lld frees\n", c->name, c->obj_size, c->in_use,
+				c->peak, c->slab_cnt, c->allocs, c->frees);
+	}
+}
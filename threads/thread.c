@@ -311,6 +311,7 @@ void thread_exit(void)
 #ifdef USERPROG
    process_exit();
 #endif
+   malloc_flush();
 
    /* Just set our status to dying and schedule another process.
       We will be destroyed during the call to schedule_tail(). */
@@ -12,6 +12,7 @@
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
@@ -22,6 +23,7 @@
 #include "threads/vaddr.h"
 #include "intrinsic.h"
 #include "threads/synch.h"
+#include "threads/slab.h"
 #ifdef VM
 #include "vm/vm.h"
 #endif
@@ -172,10 +174,19 @@ __do_fork(void *aux)
       goto error;
 
    process_activate(current);
+   /* Keep the executable write-protected for as long as the child may
+    * still map its text. */
+   if (parent->running_file != NULL)
+   {
+      current->running_file = file_duplicate(parent->running_file);
+      if (current->running_file == NULL)
+         goto error;
+   }
 #ifdef VM
    supplemental_page_table_init(&current->spt);
    if (!supplemental_page_table_copy(&current->spt, &parent->spt))
       goto error;
+   current->stack_bottom = parent->stack_bottom;
 #else
    if (!pml4_for_each(parent->pml4, duplicate_pte, parent))
       goto error;
@@ -759,36 +770,67 @@ install_page(void *upage, void *kpage, bool writable)
  * If you want to implement the function for only project 2, implement it on the
  * upper block. */
 
+/* Segment objects, allocated on every lazily loaded page fault. */
+static struct slab_cache segment_slab;
+
+/* Initializes the segment allocator. */
+void
+segment_init(void)
+{
+   slab_cache_init(&segment_slab, "segment", sizeof(struct segment));
+}
+
+/* Returns a new segment covering READ_BYTES bytes of INODE at OFS
+ * followed by ZERO_BYTES zeros, holding its own reference to INODE,
+ * or a null pointer if memory is exhausted. */
+struct segment *
+segment_create(struct inode *inode, off_t ofs, uint32_t read_bytes,
+               uint32_t zero_bytes)
+{
+   struct segment *seg = slab_alloc(&segment_slab);
+   if (seg == NULL)
+      return NULL;
+   seg->inode = inode_reopen(inode);
+   seg->ofs = ofs;
+   seg->read_bytes = read_bytes;
+   seg->zero_bytes = zero_bytes;
+   return seg;
+}
+
+/* Returns a copy of SEG, e.g. for a forked child's pending page. */
+struct segment *
+segment_duplicate(const struct segment *seg)
+{
+   return segment_create(seg->inode, seg->ofs, seg->read_bytes,
+                         seg->zero_bytes);
+}
+
+/* Releases SEG and its inode reference. */
+void
+segment_free(struct segment *seg)
+{
+   if (seg != NULL)
+   {
+      inode_close(seg->inode);
+      slab_free(&segment_slab, seg);
+   }
+}
+
+/* Reads the page's part of the segment AUX into the page's frame.
+ * AUX is consumed. */
 bool
 lazy_load_segment(struct page *page, void *aux)
 {
-   /* TODO: Load the segment from the file */
-   /* TODO: This called when the first page fault occurs on address VA. */
-   /* TODO: VA is available when calling this function. */
-
-   struct frame *load_frame = page->frame;
-	struct segment *file_info = (struct segment *)aux;
-
-	struct file *file = ((struct segment *)aux)->file;
-	off_t offset = ((struct segment *)aux)->ofs;
-	size_t page_read_bytes = ((struct segment *)aux)->read_bytes;
-	size_t page_zero_bytes = PGSIZE - page_read_bytes;
-
-	uint8_t* kva = page->frame->kva;
-	if (kva == NULL){
-		free(page);
-		return false;
-	}
-	
-	if (file_read_at(file, load_frame->kva, page_read_bytes,offset) != (int)page_read_bytes)
-	{
-		free(page);
-      free(file_info);
-		return false;
-	}
-
-	memset(load_frame->kva + page_read_bytes, 0, page_zero_bytes);
-	return true;
+   struct segment *seg = (struct segment *)aux;
+   uint8_t *kva = page->frame->kva;
+   bool success;
+
+   success = inode_read_at(seg->inode, kva, seg->read_bytes, seg->ofs)
+             == (int)seg->read_bytes;
+   if (success)
+      memset(kva + seg->read_bytes, 0, PGSIZE - seg->read_bytes);
+   segment_free(seg);
+   return success;
 }
 
 /* Loads a segment starting at offset OFS in FILE at address
@@ -813,29 +855,20 @@ load_segment(struct file *file, off_t ofs, uint8_t *upage,
    ASSERT(pg_ofs(upage) == 0);
    ASSERT(ofs % PGSIZE == 0);
 
-   while (read_bytes > 0 || zero_bytes > 0)
+   /* The whole segment becomes one region; its pages are created on
+    * first touch.  Read-only text is file-backed so that every process
+    * running this executable can map the same frames; writable data
+    * gets a private anonymous copy. */
+   struct vma *vma = vma_create(upage, (read_bytes + zero_bytes) / PGSIZE,
+                                writable ? VM_ANON : VM_FILE_TEXT, writable,
+                                writable ? lazy_load_segment : NULL,
+                                file_get_inode(file), ofs, read_bytes);
+   if (vma == NULL)
+      return false;
+   if (!vma_insert(&thread_current()->spt.vmas, vma))
    {
-      /* Do calculate how to fill this page.
-       * We will read PAGE_READ_BYTES bytes from FILE
-       * and zero the final PAGE_ZERO_BYTES bytes. */
-      size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
-      size_t page_zero_bytes = PGSIZE - page_read_bytes;
-
-      /* TODO: Set up aux to pass information to the lazy_load_segment. */
-      struct segment *aux = (struct segment *)malloc(sizeof(struct segment));
-      aux->file = file;
-      aux->ofs = ofs;
-      aux->read_bytes = page_read_bytes;
-      if (!vm_alloc_page_with_initializer(VM_ANON, upage, writable, lazy_load_segment, aux)) {
-         free(aux);
-         return false;
-      }
-
-      /* Advance. */
-      read_bytes -= page_read_bytes;
-      zero_bytes -= page_zero_bytes;
-      ofs += page_read_bytes;
-      upage += PGSIZE;
+      vma_destroy(vma);
+      return false;
    }
    return true;
 }
@@ -851,9 +884,15 @@ setup_stack(struct intr_frame *if_)
     * TODO: If success, set the rsp accordingly.
     * TODO: You should mark the page is stack. */
    /* TODO: Your code goes here */
-   success = vm_alloc_page(VM_ANON, stack_bottom, true);
+   /* The stack is a zero-filled region that grows down on faults. */
+   struct vma *stack = vma_create(stack_bottom, 1, VM_STACK, true, NULL,
+                                  NULL, 0, 0);
+   if (stack == NULL)
+      return false;
+   success = vma_insert(&cur->spt.vmas, stack);
+   if (!success)
+      vma_destroy(stack);
    if(success) {
-      struct page *page = spt_find_page(&cur->spt, stack_bottom);
       success = vm_claim_page(stack_bottom);
       if(success) {
          if_->rsp = (uintptr_t)USER_STACK;
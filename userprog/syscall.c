@@ -400,7 +400,7 @@ struct page *check_page_address(void *addr) {
       exit(-1);
    }
    struct thread *cur = thread_current();
-   struct page *page = spt_find_page(&cur->spt, addr);
+   struct page *page = spt_get_page(&cur->spt, addr);
    if(is_kernel_vaddr(addr)) {
       return -1;
    }
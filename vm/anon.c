@@ -2,6 +2,9 @@
 
 #include "vm/vm.h"
 #include "devices/disk.h"
+#include <bitmap.h>
+#include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* DO NOT MODIFY BELOW LINE */
 static struct disk *swap_disk;
@@ -17,36 +20,140 @@ static const struct page_operations anon_ops = {
 	.type = VM_ANON,
 };
 
+/* Number of disk sectors in one swap slot, i.e. one page. */
+#define SECTORS_PER_SLOT (PGSIZE / DISK_SECTOR_SIZE)
+
+/* Swap area.  One bit per page-sized slot on SWAP_DISK, set while the
+ * slot holds a swapped-out page. */
+static struct bitmap *swap_table;
+static struct lock swap_lock;
+
+/* Next-fit cursor: slot allocation resumes the search where the
+ * previous one stopped instead of rescanning from slot 0. */
+static size_t swap_cursor;
+
 /* Initialize the data for anonymous pages */
 void
 vm_anon_init (void) {
 	/* TODO: Set up the swap_disk. */
-	swap_disk = NULL;
+	size_t slot_cnt = 0;
+
+	lock_init (&swap_lock);
+	swap_disk = disk_get (1, 1);
+	if (swap_disk != NULL)
+		slot_cnt = disk_size (swap_disk) / SECTORS_PER_SLOT;
+	swap_table = bitmap_create (slot_cnt);
+	if (swap_table == NULL)
+		PANIC ("swap table creation failed");
+	swap_cursor = 0;
+}
+
+/* Reserves a free swap slot and returns its index, or BITMAP_ERROR if
+ * the swap area is full. */
+static size_t
+swap_slot_alloc (void) {
+	size_t slot;
+
+	lock_acquire (&swap_lock);
+	slot = bitmap_scan_and_flip (swap_table, swap_cursor, 1, false);
+	if (slot == BITMAP_ERROR && swap_cursor != 0)
+		slot = bitmap_scan_and_flip (swap_table, 0, 1, false);
+	if (slot != BITMAP_ERROR)
+		swap_cursor = slot + 1 < bitmap_size (swap_table) ? slot + 1 : 0;
+	lock_release (&swap_lock);
+	return slot;
+}
+
+/* Returns SLOT to the swap area. */
+static void
+swap_slot_free (size_t slot) {
+	lock_acquire (&swap_lock);
+	ASSERT (bitmap_test (swap_table, slot));
+	bitmap_reset (swap_table, slot);
+	lock_release (&swap_lock);
+}
+
+/* Reads the page stored in SLOT into KVA. */
+static void
+swap_slot_read (size_t slot, void *kva) {
+	for (size_t i = 0; i < SECTORS_PER_SLOT; i++)
+		disk_read (swap_disk, slot * SECTORS_PER_SLOT + i,
+				(uint8_t *) kva + i * DISK_SECTOR_SIZE);
+}
+
+/* Writes the page at KVA into SLOT. */
+static void
+swap_slot_write (size_t slot, const void *kva) {
+	for (size_t i = 0; i < SECTORS_PER_SLOT; i++)
+		disk_write (swap_disk, slot * SECTORS_PER_SLOT + i,
+				(const uint8_t *) kva + i * DISK_SECTOR_SIZE);
 }
 
 /* Initialize the file mapping */
 bool
 anon_initializer (struct page *page, enum vm_type type, void *kva) {
+	/* A page without a lazy loader starts out zero-filled, but KVA is
+	 * not cleared here: vm_do_claim_page() takes such a page's frame
+	 * from the pre-zeroed stock, and every other caller overwrites
+	 * the whole frame. */
+
 	/* Set up the handler */
 	page->operations = &anon_ops;
 
 	struct anon_page *anon_page = &page->anon;
+	anon_page->swap_slot = BITMAP_ERROR;
+	return true;
+}
+
+/* Copies the swapped-out contents of PAGE into KVA, leaving PAGE in
+ * swap.  Used when another address space needs its own copy. */
+bool
+anon_swap_copy (struct page *page, void *kva) {
+	struct anon_page *anon_page = &page->anon;
+
+	if (anon_page->swap_slot == BITMAP_ERROR)
+		return false;
+	swap_slot_read (anon_page->swap_slot, kva);
+	return true;
 }
 
 /* Swap in the page by read contents from the swap disk. */
 static bool
 anon_swap_in (struct page *page, void *kva) {
 	struct anon_page *anon_page = &page->anon;
+
+	if (anon_page->swap_slot == BITMAP_ERROR)
+		return false;
+	swap_slot_read (anon_page->swap_slot, kva);
+	swap_slot_free (anon_page->swap_slot);
+	anon_page->swap_slot = BITMAP_ERROR;
+	return true;
 }
 
 /* Swap out the page by writing contents to the swap disk. */
 static bool
 anon_swap_out (struct page *page) {
 	struct anon_page *anon_page = &page->anon;
+	size_t slot;
+
+	ASSERT (page->frame != NULL);
+	slot = swap_slot_alloc ();
+	if (slot == BITMAP_ERROR)
+		return false;
+	swap_slot_write (slot, page->frame->kva);
+	anon_page->swap_slot = slot;
+	return true;
 }
 
 /* Destroy the anonymous page. PAGE will be freed by the caller. */
 static void
 anon_destroy (struct page *page) {
 	struct anon_page *anon_page = &page->anon;
+
+	vm_wait_eviction (page);
+	if (anon_page->swap_slot != BITMAP_ERROR) {
+		swap_slot_free (anon_page->swap_slot);
+		anon_page->swap_slot = BITMAP_ERROR;
+	}
+	vm_free_frame (page);
 }
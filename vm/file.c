@@ -2,7 +2,14 @@
 
 #include "vm/vm.h"
 #include "threads/vaddr.h"
+#include "threads/mmu.h"
+#include "threads/malloc.h"
+#include "filesys/inode.h"
 #include "userprog/process.h"
+#include "userprog/syscall.h"
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
 
 static bool file_backed_swap_in (struct page *page, void *kva);
 static bool file_backed_swap_out (struct page *page);
@@ -16,12 +23,26 @@ static const struct page_operations file_ops = {
 	.type = VM_FILE,
 };
 
+/* Mapped page counters. */
+static long long pages_written;     /* Dirty pages written back. */
+static long long pages_dropped;     /* Clean pages evicted without I/O. */
+
 /* The initializer of file vm */
 void
 vm_file_init (void) {
 }
 
+/* Prints file-backed page statistics. */
+void
+vm_file_print_stats (void) {
+	printf ("VM: file pages: %lld written back, %lld dropped clean\n",
+			pages_written, pages_dropped);
+}
+
 /* Initialize the file backed page */
+/* Takes over the segment in the page's aux and, if KVA is given, reads
+ * the page into it.  A null KVA means the caller maps a frame that
+ * already holds the contents. */
 bool
 file_backed_initializer (struct page *page, enum vm_type type, void *kva) {
 	struct segment *aux = (struct segment *)page->uninit.aux;
@@ -29,79 +50,165 @@ file_backed_initializer (struct page *page, enum vm_type type, void *kva) {
 	page->operations = &file_ops;
 
 	struct file_page *file_page = &page->file;
+	file_page->inode = aux->inode;
+	file_page->ofs = aux->ofs;
+	file_page->read_bytes = aux->read_bytes;
+	file_page->zero_bytes = PGSIZE - aux->read_bytes;
+	file_page->text = type == VM_FILE_TEXT;
+	inode_reopen (aux->inode);
+	segment_free (aux);
+
+	return kva == NULL || file_backed_swap_in (page, kva);
 }
 
 /* Swap in the page by read contents from the file. */
 static bool
 file_backed_swap_in (struct page *page, void *kva) {
 	struct file_page *file_page UNUSED = &page->file;
+
+	if (inode_read_at (file_page->inode, kva, file_page->read_bytes,
+				file_page->ofs) != (off_t) file_page->read_bytes)
+		return false;
+	memset (kva + file_page->read_bytes, 0, file_page->zero_bytes);
+	return true;
+}
+
+/* Writes PAGE's frame back to the file if the page was modified
+ * through its mapping.  Only the bytes that came from the file are
+ * written, so a mapping never extends its file. */
+static bool
+file_backed_write_back (struct page *page) {
+	struct file_page *file_page = &page->file;
+	uint64_t *pml4 = page->owner->pml4;
+
+	if (page->frame == NULL || !page->writable || pml4 == NULL
+			|| !pml4_is_dirty (pml4, page->va))
+		return true;
+	if (inode_write_at (file_page->inode, page->frame->kva,
+				file_page->read_bytes, file_page->ofs)
+			!= (off_t) file_page->read_bytes)
+		return false;
+	pml4_set_dirty (pml4, page->va, false);
+	pages_written++;
+	return true;
 }
 
 /* Swap out the page by writeback contents to the file. */
+/* Clean pages are simply dropped: they read back from the file. */
 static bool
 file_backed_swap_out (struct page *page) {
 	struct file_page *file_page UNUSED = &page->file;
+	uint64_t *pml4 = page->owner->pml4;
+
+	if (!page->writable || !pml4_is_dirty (pml4, page->va)) {
+		pages_dropped++;
+		return true;
+	}
+	return file_backed_write_back (page);
 }
 
 /* Destory the file backed page. PAGE will be freed by the caller. */
+/* Modified contents are written back first, under the file system
+ * lock unless the caller already holds it, e.g. when a process exits
+ * from inside a system call. */
 static void
 file_backed_destroy (struct page *page) {
 	struct file_page *file_page UNUSED = &page->file;
-	free(page->frame);
+
+	vm_wait_eviction (page);
+	if (page->writable && page->frame != NULL) {
+		bool held = lock_held_by_current_thread (&filesys_lock);
+		if (!held)
+			lock_acquire (&filesys_lock);
+		file_backed_write_back (page);
+		if (!held)
+			lock_release (&filesys_lock);
+	}
+	vm_free_frame (page);
+	inode_close (file_page->inode);
+}
+
+/* If PAGE is, or will become, shared executable text, stores the
+ * inode and offset it is loaded from in *INODE and *OFS and returns
+ * true. */
+bool
+file_page_text_key (struct page *page, struct inode **inode, off_t *ofs) {
+	if (VM_TYPE (page->operations->type) == VM_UNINIT) {
+		struct segment *aux = (struct segment *)page->uninit.aux;
+		if (page->uninit.type != VM_FILE_TEXT || aux == NULL)
+			return false;
+		*inode = aux->inode;
+		*ofs = aux->ofs;
+		return true;
+	}
+	if (page->operations == &file_ops && page->file.text) {
+		*inode = page->file.inode;
+		*ofs = page->file.ofs;
+		return true;
+	}
+	return false;
 }
 
 /* Do the mmap */
+/* Maps LENGTH bytes of FILE starting at OFFSET to ADDR, lazily, as a
+ * single region holding its own reopened file.  Pages are created as
+ * they are touched, each with its own inode reference.  Bytes past the
+ * end of the file read as zeros and are never written back.  Returns
+ * ADDR, or NULL if the range is invalid or overlaps another region. */
 void *
 do_mmap (void *addr, size_t length, int writable, struct file *file, off_t offset) {
-	void *return_value = addr;
-	struct file *reopen_file = file_reopen(file);
-	if(reopen_file == NULL) {
+	struct vma_table *vmas = &thread_current ()->spt.vmas;
+	struct vma *vma;
+	struct file *mapped;
+	size_t page_cnt;
+	off_t file_size;
+
+	if (addr == NULL || pg_ofs (addr) != 0 || offset % PGSIZE != 0
+			|| length == 0)
+		return NULL;
+	page_cnt = DIV_ROUND_UP (length, PGSIZE);
+	if (!is_user_vaddr (addr)
+			|| page_cnt > (USER_STACK - (uint64_t) addr) / PGSIZE
+			|| vma_overlaps (vmas, addr, addr + page_cnt * PGSIZE))
+		return NULL;
+
+	mapped = file_reopen (file);
+	if (mapped == NULL)
+		return NULL;
+	file_size = file_length (mapped);
+	if (file_size == 0) {
+		file_close (mapped);
 		return NULL;
 	}
-	size_t file_size = (size_t)file_length(reopen_file);
-	size_t read_bytes = length > file_size ? file_size : length; 
-
-	while(read_bytes > 0) {
-		size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
-		size_t page_zero_bytes = PGSIZE - page_read_bytes;
-
-		struct segment *aux = (struct segment *)malloc(sizeof(struct segment));
-		aux->file = file;
-		aux->ofs = offset;
-		aux->read_bytes = page_read_bytes;
-		if (!vm_alloc_page_with_initializer(VM_FILE, addr, writable, lazy_load_segment, aux)) {
-			free(aux);
-			return NULL;
-		}
-
-		/* Advance. */
-		read_bytes -= page_read_bytes;
-		offset += page_read_bytes;
-		addr += PGSIZE;
+	vma = vma_create (addr, page_cnt, VM_FILE, writable, NULL,
+			file_get_inode (mapped), offset,
+			file_size > offset ? file_size - offset : 0);
+	if (vma == NULL) {
+		file_close (mapped);
+		return NULL;
 	}
-
-	return return_value;
+	vma->file = mapped;
+	if (!vma_insert (vmas, vma)) {
+		vma_destroy (vma);
+		return NULL;
+	}
+	return addr;
 }
 
 /* Do the munmap */
+/* Removes the mapping that starts at ADDR.  Dirty pages are written
+ * back as they are destroyed, their frames go back to the user pool,
+ * and the mapping's file is closed. */
 void
 do_munmap (void *addr) {
-	struct thread *cur = thread_current();
-	struct supplemental_page_table *spt = &cur->spt;
-	struct page *page = spt_find_page(spt, addr);
-	if(page == NULL) {
-		return ;
-	}
-	while(page != NULL) {
-		struct segment *seg = (struct segment *)page->uninit.aux;
-		if(pml4_is_dirty(cur->pml4, addr)) {
-			lock_acquire(&filesys_lock);
-			file_write_at(seg->file, addr, seg->read_bytes, seg->ofs);
-			lock_release(&filesys_lock);
-			pml4_set_dirty(cur->pml4, addr, 0);
-		}
-		pml4_clear_page(cur->pml4, page->va);
-		addr += PGSIZE;
-		page = spt_find_page(&cur->spt, addr);
-	}
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct vma *vma = vma_find (&spt->vmas, addr);
+
+	if (vma == NULL || vma->start != addr || vma->file == NULL)
+		return;
+	while (!list_empty (&vma->pages))
+		spt_remove_page (spt, list_entry (list_front (&vma->pages),
+					struct page, vma_elem));
+	vma_remove (&spt->vmas, vma);
+	vma_destroy (vma);
 }
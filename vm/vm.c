@@ -1,17 +1,103 @@
 /* vm.c: Generic interface for virtual memory objects. */
 
 #include "threads/malloc.h"
+#include "threads/slab.h"
 #include "vm/vm.h"
 #include "vm/inspect.h"
 #include "lib/kernel/hash.h"
+#include "threads/palloc.h"
 #include "threads/vaddr.h"
 #include "threads/mmu.h"
 #include "lib/string.h"
 #include "userprog/process.h"
+#include "filesys/inode.h"
+#include <stdio.h>
+#include <round.h>
+#include "intrinsic.h"
+
+/* Frame table: one entry per page of the user pool, indexed by
+ * physical frame number relative to FRAME_BASE. */
+static struct frame *frame_table;
+static size_t frame_table_size;
+static uint8_t *frame_base;
+
+/* Frames handed out to user pages, in allocation order. */
+struct list frame_list;
+static struct lock frame_lock;
+
+/* Signaled, with FRAME_LOCK, when an eviction finishes. */
+static struct condition frame_evicted;
+
+/* A zeroed kernel page mapped read-only wherever an untouched
+ * anonymous page is read before it is written. */
+static void *zero_frame;
+
+/* Frames holding executable text, keyed by (inode, offset), so that
+ * every process running the same program maps the same frames. */
+static struct hash text_frames;
+
+/* Clock hand for the second-chance policies: index of the next frame
+ * table entry to look at. */
+static size_t clock_hand;
+static size_t frame_cnt;
+
+enum vm_evict_policy vm_evict_policy = VM_EVICT_ECLOCK;
+size_t vm_fault_around = 8;
+bool vm_huge_pages;
+
+static const char *evict_policy_names[VM_EVICT_CNT] = {
+	[VM_EVICT_FIFO] = "fifo",
+	[VM_EVICT_CLOCK] = "clock",
+	[VM_EVICT_ECLOCK] = "eclock",
+};
+
+/* Eviction counters, kept per policy so runs can be compared. */
+struct evict_stats {
+	long long evicted;          /* Frames reclaimed. */
+	long long clean;            /* ...whose page was not dirty. */
+	long long dirty;            /* ...whose page had to be written back. */
+	long long scanned;          /* Frames inspected while picking victims. */
+	long long second_chances;   /* Accessed bits cleared by the clock. */
+};
+static struct evict_stats evict_stats[VM_EVICT_CNT];
+static long long fault_cnt;     /* Faults resolved by the VM. */
+
+/* Copy-on-write fork counters. */
+static long long fork_cnt;          /* Address spaces copied. */
+static long long fork_cycles;       /* TSC cycles spent copying them. */
+static long long fork_shared;       /* Pages shared with the parent. */
+static long long fork_copied;       /* Pages copied eagerly at fork. */
+static long long cow_copied;        /* Write faults that copied a frame. */
+static long long cow_reused;        /* ...that found the frame unshared. */
+
+/* Shared text counters. */
+static long long text_read;         /* Text pages read from disk. */
+static long long text_shared;       /* ...found already resident. */
+
+/* Zero page counters. */
+static long long zero_maps;         /* Read faults given the zero frame. */
+static long long zero_breaks;       /* ...later written, getting a frame. */
+
+/* Huge page counters. */
+static long long huge_maps;         /* 2 MiB regions mapped at once. */
+static long long huge_fallbacks;    /* ...that found no aligned frames. */
+
+/* Fault-around counters. */
+static long long around_reads;      /* Batched segment reads. */
+static long long around_pages;      /* Neighbours populated by them. */
+
+/* Region counters. */
+static long long vma_pages;         /* Pages created from their region. */
+
+/* Page objects. */
+static struct slab_cache page_slab;
+
+static unsigned text_hash (const struct hash_elem *, void *);
+static bool text_less (const struct hash_elem *, const struct hash_elem *,
+		void *);
 
 /* Initializes the virtual memory subsystem by invoking each subsystem's
  * intialize codes. */
-struct list frame_list;
 void
 vm_init (void) {
 	vm_anon_init ();
@@ -24,6 +110,74 @@ vm_init (void) {
 	/* DO NOT MODIFY UPPER LINES. */
 	/* TODO: Your code goes here. */
 	list_init(&frame_list);
+	lock_init(&frame_lock);
+	cond_init (&frame_evicted);
+	hash_init (&text_frames, text_hash, text_less, NULL);
+	slab_cache_init (&page_slab, "page", sizeof (struct page));
+	vma_init ();
+	segment_init ();
+	zero_frame = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+
+	frame_base = palloc_user_pool (&frame_table_size);
+	frame_table = palloc_get_multiple (PAL_ASSERT | PAL_ZERO,
+			DIV_ROUND_UP (frame_table_size * sizeof *frame_table, PGSIZE));
+	for (size_t i = 0; i < frame_table_size; i++) {
+		frame_table[i].kva = frame_base + i * PGSIZE;
+		list_init (&frame_table[i].pages);
+	}
+}
+
+/* Returns the frame table entry for the user pool page at KVA, or NULL
+ * if KVA is not in the user pool. */
+struct frame *
+vm_frame_lookup (void *kva) {
+	size_t pfn = ((uint8_t *) pg_round_down (kva) - frame_base) / PGSIZE;
+	if ((uint8_t *) kva < frame_base || pfn >= frame_table_size)
+		return NULL;
+	return &frame_table[pfn];
+}
+
+/* Selects the eviction policy named NAME.  Returns false if there is
+ * no such policy. */
+bool
+vm_set_evict_policy (const char *name) {
+	for (int i = 0; i < VM_EVICT_CNT; i++)
+		if (name != NULL && !strcmp (name, evict_policy_names[i])) {
+			vm_evict_policy = i;
+			return true;
+		}
+	return false;
+}
+
+/* Prints VM statistics. */
+void
+vm_print_stats (void) {
+	const struct evict_stats *st = &evict_stats[vm_evict_policy];
+	printf ("VM: %lld faults handled, %zu of %zu frames in use\n",
+			fault_cnt, frame_cnt, frame_table_size);
+	printf ("VM: %s eviction: %lld evicted (%lld clean, %lld dirty), "
+			"%lld scanned, %lld second chances\n",
+			evict_policy_names[vm_evict_policy], st->evicted, st->clean,
+			st->dirty, st->scanned, st->second_chances);
+	printf ("VM: %lld forks, %lld pages shared, %lld copied, "
+			"%lld cycles/fork\n", fork_cnt, fork_shared, fork_copied,
+			fork_cnt ? fork_cycles / fork_cnt : 0);
+	printf ("VM: %lld copy-on-write faults (%lld copied, %lld reused)\n",
+			cow_copied + cow_reused, cow_copied, cow_reused);
+	printf ("VM: %lld text faults (%lld shared, %lld read), "
+			"%zu text frames cached\n", text_read + text_shared,
+			text_shared, text_read, hash_size (&text_frames));
+	printf ("VM: fault-around %zu: %lld batched reads, "
+			"%lld pages populated ahead\n", vm_fault_around, around_reads,
+			around_pages);
+	printf ("VM: %lld zero page mappings, %lld broken by writes\n",
+			zero_maps, zero_breaks);
+	printf ("VM: %lld huge pages mapped, %lld faults avoided, "
+			"%lld fell back to 4 kB\n", huge_maps,
+			huge_maps * (long long) (HUGE_PGCNT - 1), huge_fallbacks);
+	printf ("VM: %lld pages created on first touch of their region\n",
+			vma_pages);
+	vm_file_print_stats ();
 }
 
 /* Get the type of the page. This function is useful if you want to know the
@@ -43,6 +197,12 @@ page_get_type (struct page *page) {
 /* Helpers */
 static struct frame *vm_get_victim (void);
 static bool vm_do_claim_page (struct page *page);
+static bool vm_load_frame (struct page *page, struct frame *frame);
+static bool vm_share_text (struct page *page, struct inode *inode,
+		off_t ofs);
+static bool vm_claim_around (struct page *page);
+static bool vm_claim_huge (struct page *page);
+static bool vm_map_zero (struct page *page);
 static struct frame *vm_evict_frame (void);
 
 /* Create the pending page object with initializer. If you want to create a
@@ -61,9 +221,8 @@ vm_alloc_page_with_initializer (enum vm_type type, void *upage, bool writable,
 		/* TODO: Create the page, fetch the initialier according to the VM type,
 		 * TODO: and then create "uninit" page struct by calling uninit_new. You
 		 * TODO: should modify the field after calling the uninit_new. */
-		struct page *page = (struct page *)malloc(sizeof(struct page));
+		struct page *page = slab_alloc (&page_slab);
 		if(page == NULL) {
-			free(page);
 			goto err;
 		}
 		typedef bool (*page_initializer) (struct page *, enum vm_type, void *kva);
@@ -81,6 +240,7 @@ vm_alloc_page_with_initializer (enum vm_type type, void *upage, bool writable,
 		/* TODO: Insert the page into the spt. */
 		uninit_new(page, upage, init, type, aux, new_initializer);
 		page->writable = writable;
+		page->owner = thread_current ();
 		bool succ = spt_insert_page(spt, page);
 		return succ;
 	}
@@ -102,6 +262,38 @@ spt_find_page (struct supplemental_page_table *spt UNUSED, void *va UNUSED) {
 	return hash_entry(e, struct page, elem); // hash_entry 함수로 해당 구조체 (여기선 struct page)로 반환시켜준다. list_entry와 동일한 구조
 }
 
+/* Like spt_find_page(), but if VA has not been touched yet, creates its
+ * page from the region holding it first.  SPT must be the current
+ * thread's.  Returns NULL if VA is in no region or memory is short. */
+struct page *
+spt_get_page (struct supplemental_page_table *spt, void *va) {
+	struct page *page = spt_find_page (spt, va);
+	struct segment *aux = NULL;
+	struct vma *vma;
+
+	if (page != NULL || (vma = vma_find (&spt->vmas, va)) == NULL)
+		return page;
+	va = pg_round_down (va);
+	if (vma->inode != NULL) {
+		/* Pages past the file's part of the region read as zeros. */
+		off_t skip = (uint8_t *) va - (uint8_t *) vma->start;
+		off_t left = vma->read_bytes > skip ? vma->read_bytes - skip : 0;
+		size_t read_bytes = left < PGSIZE ? left : PGSIZE;
+
+		aux = segment_create (vma->inode, vma->ofs + skip, read_bytes,
+				PGSIZE - read_bytes);
+		if (aux == NULL)
+			return NULL;
+	}
+	if (!vm_alloc_page_with_initializer (vma->type, va, vma->writable,
+				vma->init, aux)) {
+		segment_free (aux);
+		return NULL;
+	}
+	vma_pages++;
+	return spt_find_page (spt, va);
+}
+
 /* Insert PAGE into spt with validation. */
 bool
 spt_insert_page (struct supplemental_page_table *spt UNUSED,
@@ -113,32 +305,324 @@ spt_insert_page (struct supplemental_page_table *spt UNUSED,
 	}
 	if(hash_insert(&spt->hash, &page->elem) == NULL) {
 		succ = true; // hash table에 page가 삽입이 되면 true, 안되면 false를 반환한다.
+		page->vma = vma_find (&spt->vmas, page->va);
+		if (page->vma != NULL)
+			list_push_back (&page->vma->pages, &page->vma_elem);
 	}
 	return succ;
 }
 
 void
 spt_remove_page (struct supplemental_page_table *spt, struct page *page) {
+	hash_delete (&spt->hash, &page->elem);
+	if (page->vma != NULL)
+		list_remove (&page->vma_elem);
 	vm_dealloc_page (page); // page를 해제시켜준다.
-	return true;
+}
+
+/* Returns true if PAGE is mapped to the shared zero frame. */
+static bool
+page_maps_zero (struct page *page) {
+	return page->frame == NULL && page->owner != NULL
+		&& page->owner->pml4 != NULL
+		&& pml4_get_page (page->owner->pml4, page->va) == zero_frame;
+}
+
+/* Returns true if PAGE is a pending anonymous page without a loader,
+ * which starts out all zeros. */
+static bool
+page_starts_zero (struct page *page) {
+	return VM_TYPE (page->operations->type) == VM_UNINIT
+		&& page_get_type (page) == VM_ANON && page->uninit.init == NULL;
+}
+
+/* Returns the frame under the clock hand and advances the hand,
+ * wrapping around at the end of the frame table. */
+static struct frame *
+clock_advance (void) {
+	struct frame *frame = &frame_table[clock_hand];
+	if (++clock_hand >= frame_table_size)
+		clock_hand = 0;
+	return frame;
+}
+
+/* Returns true if FRAME holds a page that can be evicted right now.
+ * Free frames have no page, pinned frames are being filled or copied,
+ * and frames shared copy-on-write stay put until the sharing is
+ * broken.  Shared text is read-only, so it is simply unmapped from
+ * every process using it. */
+static bool
+frame_evictable (const struct frame *frame) {
+	return frame->page != NULL && frame->pin_cnt == 0
+		&& (frame->ref_cnt == 1 || frame->text_inode != NULL);
+}
+
+/* The accessed and dirty bits of a frame are those of all the page
+ * table entries mapping it. */
+static bool
+frame_accessed (struct frame *frame) {
+	struct list_elem *e;
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, share_elem);
+		if (pml4_is_accessed (page->owner->pml4, page->va))
+			return true;
+	}
+	return false;
+}
+
+static bool
+frame_dirty (struct frame *frame) {
+	struct list_elem *e;
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, share_elem);
+		if (pml4_is_dirty (page->owner->pml4, page->va))
+			return true;
+	}
+	return false;
+}
+
+static void
+frame_clear_accessed (struct frame *frame) {
+	struct list_elem *e;
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, share_elem);
+		pml4_set_accessed (page->owner->pml4, page->va, false);
+	}
+}
+
+static unsigned
+text_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct frame *frame = hash_entry (e, struct frame, text_elem);
+	return hash_bytes (&frame->text_inode, sizeof frame->text_inode)
+		^ hash_int (frame->text_ofs);
+}
+
+static bool
+text_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct frame *a = hash_entry (a_, struct frame, text_elem);
+	const struct frame *b = hash_entry (b_, struct frame, text_elem);
+	if (a->text_inode != b->text_inode)
+		return a->text_inode < b->text_inode;
+	return a->text_ofs < b->text_ofs;
+}
+
+/* Caches FRAME as the text page (INODE, OFS).  If another process read
+ * the same page meanwhile, FRAME stays private. */
+static void
+text_remember (struct frame *frame, struct inode *inode, off_t ofs) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	frame->text_inode = inode;
+	frame->text_ofs = ofs;
+	if (hash_insert (&text_frames, &frame->text_elem) != NULL)
+		frame->text_inode = NULL;
+}
+
+/* Returns the frame caching text page (INODE, OFS), or NULL. */
+static struct frame *
+text_lookup (struct inode *inode, off_t ofs) {
+	struct frame key;
+	struct hash_elem *e;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	key.text_inode = inode;
+	key.text_ofs = ofs;
+	e = hash_find (&text_frames, &key.text_elem);
+	return e != NULL ? hash_entry (e, struct frame, text_elem) : NULL;
+}
+
+/* Drops FRAME from the text cache, if it is there. */
+static void
+text_forget (struct frame *frame) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	if (frame->text_inode != NULL) {
+		hash_delete (&text_frames, &frame->text_elem);
+		frame->text_inode = NULL;
+	}
+}
+
+/* Second chance: sweeps the hand, clearing accessed bits, until it
+ * finds a frame that has not been referenced since the last sweep. */
+static struct frame *
+get_victim_clock (struct evict_stats *st) {
+	for (size_t i = 0; i < 2 * frame_table_size + 1; i++) {
+		struct frame *frame = clock_advance ();
+		st->scanned++;
+		if (!frame_evictable (frame))
+			continue;
+		if (!frame_accessed (frame))
+			return frame;
+		frame_clear_accessed (frame);
+		st->second_chances++;
+	}
+	return NULL;
+}
+
+/* Enhanced second chance.  Frames fall into four classes by their
+ * (accessed, dirty) bits; the lowest non-empty class is evicted.
+ * Each round first looks for a (0,0) frame without touching any bits,
+ * then for a (0,1) frame while clearing accessed bits, so that the
+ * next round is guaranteed to find something. */
+static struct frame *
+get_victim_eclock (struct evict_stats *st) {
+	for (int round = 0; round < 2; round++) {
+		for (size_t i = 0; i < frame_table_size; i++) {
+			struct frame *frame = clock_advance ();
+			st->scanned++;
+			if (frame_evictable (frame)
+					&& !frame_accessed (frame) && !frame_dirty (frame))
+				return frame;
+		}
+		for (size_t i = 0; i < frame_table_size; i++) {
+			struct frame *frame = clock_advance ();
+			st->scanned++;
+			if (!frame_evictable (frame))
+				continue;
+			if (!frame_accessed (frame))
+				return frame;
+			frame_clear_accessed (frame);
+			st->second_chances++;
+		}
+	}
+	return NULL;
+}
+
+/* FIFO: the oldest frame, which is then requeued as the youngest. */
+static struct frame *
+get_victim_fifo (struct evict_stats *st) {
+	struct list_elem *e;
+	for (e = list_begin (&frame_list); e != list_end (&frame_list);
+			e = list_next (e)) {
+		struct frame *frame = list_entry (e, struct frame, frame_elem);
+		st->scanned++;
+		if (frame_evictable (frame)) {
+			list_remove (e);
+			list_push_back (&frame_list, e);
+			return frame;
+		}
+	}
+	return NULL;
 }
 
 /* Get the struct frame, that will be evicted. */
 static struct frame *
 vm_get_victim (void) {
-	struct frame *victim = NULL;
-	 /* TODO: The policy for eviction is up to you. */
-	victim = list_pop_front(&frame_list); // FIFO형식으로 일단 구현
-	return victim;
+	struct evict_stats *st = &evict_stats[vm_evict_policy];
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+	switch (vm_evict_policy) {
+		case VM_EVICT_FIFO:
+			return get_victim_fifo (st);
+		case VM_EVICT_CLOCK:
+			return get_victim_clock (st);
+		case VM_EVICT_ECLOCK:
+		default:
+			return get_victim_eclock (st);
+	}
+}
+
+/* Waits until PAGE's frame, if it has one, is not being evicted.
+ * FRAME_LOCK must be held; it is dropped while waiting. */
+static void
+wait_eviction (struct page *page) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+	while (page->frame != NULL && page->frame->evicting)
+		cond_wait (&frame_evicted, &frame_lock);
+}
+
+/* Waits until PAGE is not in the middle of being evicted, so that its
+ * frame and swap slot can be looked at or released. */
+void
+vm_wait_eviction (struct page *page) {
+	lock_acquire (&frame_lock);
+	wait_eviction (page);
+	lock_release (&frame_lock);
+}
+
+/* Waits out any eviction of PAGE.  Returns true if PAGE is resident
+ * and mapped after all, because the eviction failed, so that a fault
+ * on it only has to be retried. */
+static bool
+vm_settle (struct page *page) {
+	bool mapped;
+
+	lock_acquire (&frame_lock);
+	wait_eviction (page);
+	mapped = page->frame != NULL
+		&& pml4_get_page (page->owner->pml4, page->va) != NULL;
+	lock_release (&frame_lock);
+	return mapped;
 }
 
 /* Evict one page and return the corresponding frame.
  * Return NULL on error.*/
+/* The victim is picked, pinned and unmapped under FRAME_LOCK, which is
+ * then dropped while its page is written out, so that other faults do
+ * not wait on the disk.  Meanwhile the frame is marked EVICTING, and
+ * anyone who wants the page waits for FRAME_EVICTED.  The frame comes
+ * back pinned. */
 static struct frame *
 vm_evict_frame (void) {
-	struct frame *victim UNUSED = vm_get_victim ();
-	/* TODO: swap out the victim and return the evicted frame. */
-	swap_out(victim->page);
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	struct frame *victim = vm_get_victim ();
+	if (victim == NULL)
+		return NULL;
+
+	struct page *page = victim->page;
+	bool dirty = frame_dirty (victim);
+	struct list_elem *e;
+	bool succ;
+
+	/* Unmap first so that the owner cannot modify the page while it is
+	 * being written out.  The dirty bit survives the unmapping.  The
+	 * frame stops being offered as shared text right away, so that no
+	 * new page maps it. */
+	victim->pin_cnt++;
+	victim->evicting = true;
+	text_forget (victim);
+	for (e = list_begin (&victim->pages); e != list_end (&victim->pages);
+			e = list_next (e)) {
+		struct page *p = list_entry (e, struct page, share_elem);
+		pml4_clear_page (p->owner->pml4, p->va);
+	}
+	lock_release (&frame_lock);
+	succ = swap_out (page);
+	lock_acquire (&frame_lock);
+
+	victim->evicting = false;
+	cond_broadcast (&frame_evicted, &frame_lock);
+	if (!succ) {
+		for (e = list_begin (&victim->pages); e != list_end (&victim->pages);
+				e = list_next (e)) {
+			struct page *p = list_entry (e, struct page, share_elem);
+			pml4_set_page (p->owner->pml4, p->va, victim->kva, p->writable);
+		}
+		victim->pin_cnt--;
+		return NULL;
+	}
+
+	struct evict_stats *st = &evict_stats[vm_evict_policy];
+	st->evicted++;
+	if (dirty)
+		st->dirty++;
+	else
+		st->clean++;
+
+	while (!list_empty (&victim->pages)) {
+		struct page *p = list_entry (list_pop_front (&victim->pages),
+				struct page, share_elem);
+		p->frame = NULL;
+		p->is_loaded = false;
+	}
+	victim->page = NULL;
+	victim->ref_cnt = 0;
 	return victim;
 }
 
@@ -146,44 +630,214 @@ vm_evict_frame (void) {
  * and return it. This always return valid address. That is, if the user pool
  * memory is full, this function evicts the frame to get the available memory
  * space.*/
+/* The frame comes back pinned; the caller unpins it with frame_unpin()
+ * once the page it is meant for has been filled and linked.  If ZERO,
+ * the frame is filled with zeros, usually by taking one that the page
+ * allocator cleared in advance. */
 static struct frame *
-vm_get_frame (void) {
+vm_get_frame (bool zero) {
 	struct frame *frame = NULL;
-	/* TODO: Fill this function. */
-	frame = (struct frame *)malloc(sizeof(struct frame));
-	frame->kva = palloc_get_page(PAL_USER); // 구조체 할당
-	if(frame->kva == NULL) { // 할당할 물리메모리가 부족할 경우 프레임과 연결된 페이지 한 개를 swap_out 시키고 사용 가능한 프레임을 가져온다
-		frame = vm_evict_frame();
-		frame->page = NULL;
+
+	lock_acquire (&frame_lock);
+	void *kva = palloc_get_page (PAL_USER | (zero ? PAL_ZERO : 0));
+	if (kva == NULL) {
+		/* The user pool is exhausted: recycle a victim's frame, which
+		 * stays where it is in FRAME_LIST. */
+		frame = vm_evict_frame ();
+		lock_release (&frame_lock);
+		if (frame != NULL && zero)
+			memset (frame->kva, 0, PGSIZE);
 		return frame;
 	}
-	list_push_back(&frame_list, &frame->frame_elem); // frame_list에 해당 프레임을 삽입.
-	frame->page = NULL;
+	frame = vm_frame_lookup (kva);
 	ASSERT (frame != NULL);
+	ASSERT (frame->ref_cnt == 0 && frame->pin_cnt == 0);
+	frame->page = NULL;
+	frame->pin_cnt = 1;
+	list_push_back(&frame_list, &frame->frame_elem); // frame_list에 해당 프레임을 삽입.
+	frame_cnt++;
+	lock_release (&frame_lock);
+
 	ASSERT (frame->page == NULL);
 	return frame;
 }
 
-/* Growing the stack. */
+/* Returns FRAME, which no page maps any more, to the user pool. */
 static void
-vm_stack_growth (void *addr UNUSED) {
-	struct thread *cur = thread_current();
-	bool status;
-	status = vm_alloc_page(VM_ANON, addr, true);
-	if(status) {
-		cur->stack_bottom -= PGSIZE;
+frame_release (struct frame *frame) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+	ASSERT (frame->ref_cnt == 0 && frame->pin_cnt == 0);
+
+	text_forget (frame);
+	list_remove (&frame->frame_elem);
+	frame_cnt--;
+	palloc_free_page (frame->kva);
+}
+
+/* Drops a pin taken on FRAME.  A frame whose last page went away while it was
+ * pinned is freed here. */
+static void
+frame_unpin (struct frame *frame) {
+	lock_acquire (&frame_lock);
+	ASSERT (frame->pin_cnt > 0);
+	if (--frame->pin_cnt == 0 && frame->ref_cnt == 0)
+		frame_release (frame);
+	lock_release (&frame_lock);
+}
+
+/* Adds PAGE to the pages mapping FRAME.  The caller installs the page
+ * table entry. */
+static void
+frame_link (struct frame *frame, struct page *page) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	list_push_back (&frame->pages, &page->share_elem);
+	frame->ref_cnt++;
+	if (frame->page == NULL)
+		frame->page = page;
+	page->frame = frame;
+}
+
+/* Removes PAGE from the pages mapping FRAME.  Returns true if that was
+ * the last mapping. */
+static bool
+frame_unlink (struct frame *frame, struct page *page) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+	ASSERT (page->frame == frame);
+
+	list_remove (&page->share_elem);
+	page->frame = NULL;
+	if (--frame->ref_cnt > 0) {
+		if (frame->page == page)
+			frame->page = list_entry (list_front (&frame->pages),
+					struct page, share_elem);
+		return false;
 	}
-	addr = pg_round_down(addr);
-	while(addr < cur->stack_bottom) {
-		status = vm_alloc_page(VM_ANON, addr, true);
-		vm_claim_page(addr);
-		addr += PGSIZE;
+	frame->page = NULL;
+	return true;
+}
+
+/* Detaches PAGE from its frame, if it has one, and removes the mapping
+ * from the owner's page table.  The frame goes back to the user pool
+ * once no other address space shares it. */
+void
+vm_free_frame (struct page *page) {
+	struct frame *frame = page->frame;
+	if (frame == NULL) {
+		/* The zero frame is never freed, only unmapped. */
+		if (page_maps_zero (page))
+			pml4_clear_page (page->owner->pml4, page->va);
+		return;
+	}
+
+	lock_acquire (&frame_lock);
+	wait_eviction (page);
+	frame = page->frame;
+	if (frame == NULL) {
+		lock_release (&frame_lock);
+		return;
 	}
+	if (page->owner != NULL && page->owner->pml4 != NULL)
+		pml4_clear_page (page->owner->pml4, page->va);
+	if (frame_unlink (frame, page) && frame->pin_cnt == 0)
+		frame_release (frame);
+	lock_release (&frame_lock);
+	page->is_loaded = false;
+}
+
+/* Growing the stack. */
+/* Extends the stack region down to ADDR.  The pages in between are
+ * created as they are touched. */
+static bool
+vm_stack_growth (void *addr UNUSED) {
+	struct thread *cur = thread_current();
+	struct vma *stack = vma_find (&cur->spt.vmas, cur->stack_bottom);
+
+	addr = pg_round_down (addr);
+	if (stack == NULL || !vma_grow_down (&cur->spt.vmas, stack, addr))
+		return false;
+	cur->stack_bottom = stack->start;
+	return true;
 }
 
 /* Handle the fault on write_protected page */
+/* A write to a page that is logically writable but mapped read-only
+ * means the frame is shared copy-on-write.  The last sharer simply
+ * gets write access back; anyone else takes a private copy. */
 static bool
 vm_handle_wp (struct page *page UNUSED) {
+	struct frame *old = page->frame;
+	uint64_t *pml4 = page->owner->pml4;
+
+	if (!page->writable)
+		return false;
+	if (page_maps_zero (page)) {
+		/* First write to a page that was only read so far. */
+		struct frame *frame = vm_get_frame (true);
+		if (frame == NULL)
+			return false;
+		lock_acquire (&frame_lock);
+		frame_link (frame, page);
+		lock_release (&frame_lock);
+		if (!pml4_set_page (pml4, page->va, frame->kva, true)) {
+			frame_unpin (frame);
+			vm_free_frame (page);
+			return false;
+		}
+		frame_unpin (frame);
+		zero_breaks++;
+		return true;
+	}
+	if (old == NULL)
+		return false;
+
+	lock_acquire (&frame_lock);
+	if (page->frame != old || old->evicting) {
+		/* Evicted under us: the retried write faults the page back. */
+		lock_release (&frame_lock);
+		return true;
+	}
+	if (old->ref_cnt == 1) {
+		pml4_set_writable (pml4, page->va, true);
+		lock_release (&frame_lock);
+		cow_reused++;
+		return true;
+	}
+	/* Other sharers may break away meanwhile, so keep OLD resident
+	 * while we wait for a frame of our own. */
+	old->pin_cnt++;
+	lock_release (&frame_lock);
+
+	struct frame *new = vm_get_frame (false);
+	if (new == NULL) {
+		frame_unpin (old);
+		return false;
+	}
+	memcpy (new->kva, old->kva, PGSIZE);
+
+	lock_acquire (&frame_lock);
+	if (old->ref_cnt == 1) {
+		/* The others broke away while we copied, so OLD is ours
+		 * alone after all. */
+		pml4_set_writable (pml4, page->va, true);
+		lock_release (&frame_lock);
+		frame_unpin (old);
+		frame_unpin (new);
+		cow_reused++;
+		return true;
+	}
+	frame_unlink (old, page);
+	frame_link (new, page);
+	lock_release (&frame_lock);
+	frame_unpin (old);
+	frame_unpin (new);
+
+	if (!pml4_set_page (pml4, page->va, new->kva, true)) {
+		vm_free_frame (page);
+		return false;
+	}
+	cow_copied++;
+	return true;
 }
 
 /* Return true on success */
@@ -202,20 +856,29 @@ vm_try_handle_fault (struct intr_frame *f UNUSED, void *addr UNUSED, bool user U
 	/* TODO: Validate the fault */
 	/* TODO: Your code goes here */
 	bool status = false;
-	if(is_kernel_vaddr(addr) || addr == NULL || !not_present) {
+	if(is_kernel_vaddr(addr) || addr == NULL) {
 		return status;
 	}
-	page = spt_find_page(spt, addr);
+	if (!not_present) {
+		/* Write to a present page: only copy-on-write can fix that. */
+		page = spt_find_page (spt, addr);
+		status = write && page != NULL && vm_handle_wp (page);
+		if (status)
+			fault_cnt++;
+		return status;
+	}
+	fault_cnt++;
+	page = spt_get_page(spt, addr);
 	if(page == NULL){
-		if(addr >= f->rsp - 8 && addr >= STACK_MAX && addr <= USER_STACK) {
-			vm_stack_growth(addr);
-			cur->stack_bottom = pg_round_down(addr);
-			status = true;
-			return status;
-		}
+		if(addr >= f->rsp - 8 && addr >= STACK_MAX && addr <= USER_STACK
+				&& vm_stack_growth(addr))
+			page = spt_get_page (spt, addr);
 	}
-	else {
-		status = vm_do_claim_page(page);
+	if (page != NULL) {
+		if (vm_settle (page))
+			return true;
+		status = (!write && vm_map_zero (page)) || vm_claim_huge (page)
+			|| vm_claim_around (page) || vm_do_claim_page(page);
 		return status;
 	}
 	return status;
@@ -225,7 +888,7 @@ vm_try_handle_fault (struct intr_frame *f UNUSED, void *addr UNUSED, bool user U
 void
 vm_dealloc_page (struct page *page) {
 	destroy (page);
-	free (page);
+	slab_free (&page_slab, page);
 }
 
 /* Claim the page that allocate on VA. */
@@ -234,10 +897,12 @@ vm_claim_page (void *va UNUSED) {
 	struct page *page = NULL;
 	/* TODO: Fill this function */
 	struct thread *cur = thread_current();
-	page = spt_find_page(&cur->spt, va); // 현재 스레드의 spt에서 va값을 가진 page를 찾는다. +해당 함수에서 pg_round_down(va)로 전달받은 va를 페이지 시작주소로 옮긴다.
+	page = spt_get_page(&cur->spt, va); // 현재 스레드의 spt에서 va값을 가진 page를 찾는다. +해당 함수에서 pg_round_down(va)로 전달받은 va를 페이지 시작주소로 옮긴다.
 	if(page == NULL) {
 		return false;
 	}
+	if (vm_settle (page))
+		return true;
 	
 	return vm_do_claim_page (page);
 }
@@ -245,13 +910,427 @@ vm_claim_page (void *va UNUSED) {
 /* Claim the PAGE and set up the mmu. */
 static bool
 vm_do_claim_page (struct page *page) {
-	struct frame *frame = vm_get_frame ();
+	struct inode *inode;
+	off_t ofs;
+	bool text = file_page_text_key (page, &inode, &ofs);
+
+	if (text && vm_share_text (page, inode, ofs))
+		return true;
+
+	struct frame *frame = vm_get_frame (page_starts_zero (page));
 	if(frame == NULL) {
 		return false;
 	}
+	bool succ = vm_load_frame (page, frame);
+	if (succ && text) {
+		lock_acquire (&frame_lock);
+		text_remember (frame, inode, ofs);
+		lock_release (&frame_lock);
+		text_read++;
+	}
+	frame_unpin (frame);
+	return succ;
+}
+
+/* Maps the resident frame caching text page (INODE, OFS), if any, at
+ * PAGE.  Returns false if the page has to be read from disk. */
+static bool
+vm_share_text (struct page *page, struct inode *inode, off_t ofs) {
+	struct frame *frame;
+	bool succ;
+
+	lock_acquire (&frame_lock);
+	frame = text_lookup (inode, ofs);
+	if (frame == NULL) {
+		lock_release (&frame_lock);
+		return false;
+	}
+	frame->pin_cnt++;
+	lock_release (&frame_lock);
+
+	/* The frame already holds the contents: transmute the page without
+	 * reading anything. */
+	if (VM_TYPE (page->operations->type) == VM_UNINIT
+			&& !page->uninit.page_initializer (page, page->uninit.type, NULL)) {
+		frame_unpin (frame);
+		return false;
+	}
+
+	lock_acquire (&frame_lock);
+	frame_link (frame, page);
+	succ = pml4_set_page (page->owner->pml4, page->va, frame->kva, false);
+	if (!succ)
+		frame_unlink (frame, page);
+	lock_release (&frame_lock);
+	frame_unpin (frame);
+
+	if (succ) {
+		page->is_loaded = true;
+		text_shared++;
+	}
+	return succ;
+}
+
+/* How a pending page would be loaded. */
+struct pending {
+	enum vm_type type;          /* Type it becomes. */
+	vm_initializer *init;       /* Its loader. */
+	bool writable;
+	struct inode *inode;        /* File it reads from, or NULL. */
+	off_t ofs;                  /* Offset in INODE. */
+	size_t read_bytes;          /* Bytes read; the rest are zeros. */
+};
+
+/* Describes the pending page at VA in SPT into *P.  A page that was
+ * never touched is described from its region, without creating it.
+ * Returns false if VA is in no region or its page is not pending. */
+static bool
+pending_lookup (struct supplemental_page_table *spt, void *va,
+		struct pending *p) {
+	struct page *page = spt_find_page (spt, va);
+	struct vma *vma;
+
+	if (page != NULL) {
+		struct segment *seg = page->uninit.aux;
+
+		if (VM_TYPE (page->operations->type) != VM_UNINIT)
+			return false;
+		p->type = page->uninit.type;
+		p->init = page->uninit.init;
+		p->writable = page->writable;
+		p->inode = seg != NULL ? seg->inode : NULL;
+		p->ofs = seg != NULL ? seg->ofs : 0;
+		p->read_bytes = seg != NULL ? seg->read_bytes : 0;
+		return true;
+	}
+
+	vma = vma_find (&spt->vmas, va);
+	if (vma == NULL)
+		return false;
+	p->type = vma->type;
+	p->init = vma->init;
+	p->writable = vma->writable;
+	p->inode = vma->inode;
+	p->ofs = 0;
+	p->read_bytes = 0;
+	if (vma->inode != NULL) {
+		/* As spt_get_page() would set it up. */
+		off_t skip = (uint8_t *) va - (uint8_t *) vma->start;
+		off_t left = vma->read_bytes > skip ? vma->read_bytes - skip : 0;
+
+		p->ofs = vma->ofs + skip;
+		p->read_bytes = left < PGSIZE ? left : PGSIZE;
+	}
+	return true;
+}
+
+/* Returns true if the page at VA is pending, loads OFS from the same
+ * file as PAGE in the same way, and is worth reading ahead.  Stores
+ * how many bytes it reads into *READ_BYTES. */
+static bool
+fault_around_match (void *va, struct page *page, off_t ofs,
+		size_t *read_bytes) {
+	struct supplemental_page_table *spt = &page->owner->spt;
+	struct segment *seg = page->uninit.aux;
+	struct pending p;
+	bool cached = false;
+
+	if (!pending_lookup (spt, va, &p) || p.inode == NULL
+			|| p.inode != seg->inode || p.ofs != ofs
+			|| p.type != page->uninit.type || p.init != page->uninit.init
+			|| p.writable != page->writable)
+		return false;
+	if (p.type == VM_FILE_TEXT) {
+		lock_acquire (&frame_lock);
+		cached = text_lookup (p.inode, p.ofs) != NULL;
+		lock_release (&frame_lock);
+	}
+	*read_bytes = p.read_bytes;
+	return !cached;
+}
+
+/* Gives pending PAGE a frame holding the PGSIZE bytes at SRC, which
+ * were read on its behalf. */
+static bool
+fault_around_fill (struct page *page, const void *src) {
+	struct inode *inode;
+	off_t ofs;
+	bool text = file_page_text_key (page, &inode, &ofs);
+	vm_initializer *init = page->uninit.init;
+	void *aux = page->uninit.aux;
+	struct frame *frame;
+	bool succ;
+
+	frame = vm_get_frame (false);
+	if (frame == NULL)
+		return false;
+	memcpy (frame->kva, src, PGSIZE);
+
+	lock_acquire (&frame_lock);
+	frame_link (frame, page);
+	succ = pml4_set_page (page->owner->pml4, page->va, frame->kva,
+			page->writable);
+	if (!succ)
+		frame_unlink (frame, page);
+	lock_release (&frame_lock);
+	if (!succ) {
+		frame_unpin (frame);
+		return false;
+	}
+
+	/* Transmute the page without reading anything.  The lazy loader
+	 * would only have read the same bytes, so its segment is released
+	 * here instead. */
+	page->uninit.page_initializer (page, page->uninit.type, NULL);
+	if (init != NULL)
+		segment_free (aux);
+	page->is_loaded = true;
+	if (text) {
+		lock_acquire (&frame_lock);
+		text_remember (frame, inode, ofs);
+		lock_release (&frame_lock);
+		text_read++;
+	}
+	frame_unpin (frame);
+	return true;
+}
+
+/* Loads the pending segment page PAGE together with its pending
+ * neighbours in the same VM_FAULT_AROUND-page aligned window, using a
+ * single read of the file.  Returns false, leaving PAGE untouched, if
+ * there is nothing to batch.  Neighbours are looked at through their
+ * region, so only those that are actually loaded get page objects. */
+static bool
+vm_claim_around (struct page *page) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	size_t window = vm_fault_around;
+	struct segment *seg;
+	struct inode *inode;
+	uint8_t *win_lo, *win_hi, *lo, *hi, *va, *buf;
+	off_t lo_ofs, size;
+	size_t cnt, last_read, read_bytes;
+
+	if (window < 2 || VM_TYPE (page->operations->type) != VM_UNINIT
+			|| page->uninit.aux == NULL)
+		return false;
+	seg = page->uninit.aux;
+	if (!fault_around_match (page->va, page, seg->ofs, &read_bytes))
+		return false;
+
+	/* Grow a run of pages that are contiguous in the file. */
+	win_lo = (uint8_t *) page->va - (pg_no (page->va) % window) * PGSIZE;
+	win_hi = win_lo + window * PGSIZE;
+	lo = page->va;
+	lo_ofs = seg->ofs;
+	while (lo > win_lo) {
+		if (!fault_around_match (lo - PGSIZE, page, lo_ofs - PGSIZE,
+					&read_bytes) || read_bytes != PGSIZE)
+			break;
+		lo -= PGSIZE;
+		lo_ofs -= PGSIZE;
+	}
+	hi = (uint8_t *) page->va + PGSIZE;
+	last_read = seg->read_bytes;
+	while (hi < win_hi && last_read == PGSIZE) {
+		if (!fault_around_match (hi, page, lo_ofs + (hi - lo), &read_bytes))
+			break;
+		last_read = read_bytes;
+		hi += PGSIZE;
+	}
+	cnt = (hi - lo) / PGSIZE;
+	if (cnt < 2)
+		return false;
+
+	buf = palloc_get_multiple (0, cnt);
+	if (buf == NULL)
+		return false;
+	inode = seg->inode;
+	size = (cnt - 1) * PGSIZE + last_read;
+	if (inode_read_at (inode, buf, size, lo_ofs) != size) {
+		palloc_free_multiple (buf, cnt);
+		return false;
+	}
+	memset (buf + size, 0, cnt * PGSIZE - size);
+	around_reads++;
+
+	/* The faulting page first, so that running short of frames only
+	 * costs the neighbours. */
+	if (!fault_around_fill (page, buf + ((uint8_t *) page->va - lo))) {
+		palloc_free_multiple (buf, cnt);
+		return false;
+	}
+	for (va = lo; va < hi; va += PGSIZE) {
+		if (va == page->va)
+			continue;
+		struct page *p = spt_get_page (spt, va);
+		if (p == NULL || !fault_around_fill (p, buf + (va - lo)))
+			break;
+		around_pages++;
+	}
+	palloc_free_multiple (buf, cnt);
+	return true;
+}
+
+/* Returns true if the page at VA is pending and can go into the same
+ * huge mapping as PAGE: same kind, loader and permissions.  Describes
+ * it into *P. */
+static bool
+huge_match (void *va, struct page *page, struct pending *p) {
+	return pending_lookup (&page->owner->spt, va, p)
+		&& p->type == page->uninit.type && p->init == page->uninit.init
+		&& p->writable == page->writable;
+}
+
+/* Gives back the HUGE_PGCNT pinned, unlinked frames at KVA. */
+static void
+huge_release (uint8_t *kva) {
+	lock_acquire (&frame_lock);
+	for (size_t i = 0; i < HUGE_PGCNT; i++) {
+		struct frame *frame = vm_frame_lookup (kva + i * PGSIZE);
+		frame->pin_cnt--;
+		frame_release (frame);
+	}
+	lock_release (&frame_lock);
+}
+
+/* Maps the whole 2 MiB aligned region around pending anonymous or
+ * mapped-file page PAGE with one huge page, if every page in it is
+ * pending in the same way and their contents come from at most one
+ * contiguous run of the file followed by zeros.  The frames are read
+ * with a single read.  Returns false, leaving PAGE untouched, if the
+ * region does not qualify or no aligned frames are free. */
+static bool
+vm_claim_huge (struct page *page) {
+	struct thread *cur = thread_current ();
+	uint8_t *base = huge_round_down (page->va);
+	struct inode *inode = NULL;
+	off_t ofs = 0, size = 0;
+	size_t nread = 0, i;
+	uint8_t *kva;
+	bool succ;
+
+	if (!vm_huge_pages || VM_TYPE (page->operations->type) != VM_UNINIT
+			|| (page->uninit.type != VM_ANON && page->uninit.type != VM_FILE))
+		return false;
+	/* Only a single region can fill the whole range. */
+	if (page->vma == NULL || (uint8_t *) page->vma->start > base
+			|| (uint8_t *) page->vma->end < base + HUGE_PGSIZE)
+		return false;
+
+	/* Qualify the range without creating its pages: they are only
+	 * created once the frames are in hand. */
+	for (i = 0; i < HUGE_PGCNT; i++) {
+		struct pending p;
+
+		if (!huge_match (base + i * PGSIZE, page, &p))
+			return false;
+		if (p.inode == NULL || p.read_bytes == 0)
+			continue;
+		if (nread != i)
+			return false;
+		if (i == 0) {
+			inode = p.inode;
+			ofs = p.ofs;
+		} else if (p.inode != inode || p.ofs != ofs + size
+				|| size != (off_t) (i * PGSIZE))
+			return false;
+		size += p.read_bytes;
+		nread++;
+	}
+
+	lock_acquire (&frame_lock);
+	kva = palloc_get_aligned (PAL_USER, HUGE_PGCNT, HUGE_PGCNT);
+	if (kva == NULL) {
+		lock_release (&frame_lock);
+		huge_fallbacks++;
+		return false;
+	}
+	for (i = 0; i < HUGE_PGCNT; i++) {
+		struct frame *frame = vm_frame_lookup (kva + i * PGSIZE);
+		frame->page = NULL;
+		frame->pin_cnt = 1;
+		list_push_back (&frame_list, &frame->frame_elem);
+		frame_cnt++;
+	}
+	lock_release (&frame_lock);
+
+	for (i = 0; i < HUGE_PGCNT; i++)
+		if (spt_get_page (&cur->spt, base + i * PGSIZE) == NULL) {
+			huge_release (kva);
+			return false;
+		}
+	if (size > 0 && inode_read_at (inode, kva, size, ofs) != size) {
+		huge_release (kva);
+		return false;
+	}
+	memset (kva + size, 0, HUGE_PGSIZE - size);
+
+	lock_acquire (&frame_lock);
+	for (i = 0; i < HUGE_PGCNT; i++)
+		frame_link (vm_frame_lookup (kva + i * PGSIZE),
+				spt_find_page (&cur->spt, base + i * PGSIZE));
+	succ = pml4_set_huge_page (cur->pml4, base, kva, page->writable);
+	if (!succ)
+		for (i = 0; i < HUGE_PGCNT; i++)
+			frame_unlink (vm_frame_lookup (kva + i * PGSIZE),
+					spt_find_page (&cur->spt, base + i * PGSIZE));
+	lock_release (&frame_lock);
+	if (!succ) {
+		huge_release (kva);
+		return false;
+	}
+
+	/* Transmute every page without reading, as in fault-around. */
+	for (i = 0; i < HUGE_PGCNT; i++) {
+		struct page *p = spt_find_page (&cur->spt, base + i * PGSIZE);
+		vm_initializer *init = p->uninit.init;
+		void *aux = p->uninit.aux;
+
+		p->uninit.page_initializer (p, p->uninit.type, NULL);
+		if (init != NULL)
+			segment_free (aux);
+		p->is_loaded = true;
+	}
+
+	lock_acquire (&frame_lock);
+	for (i = 0; i < HUGE_PGCNT; i++)
+		vm_frame_lookup (kva + i * PGSIZE)->pin_cnt--;
+	lock_release (&frame_lock);
+	huge_maps++;
+	return true;
+}
+
+/* Maps the zero frame read-only at PAGE if it is a pending anonymous
+ * page that would start out all zeros.  A later write goes through
+ * vm_handle_wp(), which gives the page a frame of its own. */
+static bool
+vm_map_zero (struct page *page) {
+	struct segment *seg = page->uninit.aux;
+	vm_initializer *init = page->uninit.init;
+
+	if (VM_TYPE (page->operations->type) != VM_UNINIT
+			|| page_get_type (page) != VM_ANON
+			|| (init != NULL && (seg == NULL || seg->read_bytes != 0)))
+		return false;
+	if (!pml4_set_page (page->owner->pml4, page->va, zero_frame, false))
+		return false;
+
+	page->uninit.page_initializer (page, page->uninit.type, NULL);
+	if (init != NULL)
+		segment_free (seg);
+	page->is_loaded = true;
+	zero_maps++;
+	return true;
+}
+
+/* Links PAGE to FRAME, maps it and reads in its contents.  FRAME is
+ * pinned by the caller, so it cannot be evicted half-loaded. */
+static bool
+vm_load_frame (struct page *page, struct frame *frame) {
 	/* Set links */
-	frame->page = page;
-	page->frame = frame;
+	lock_acquire (&frame_lock);
+	frame_link (frame, page);
+	lock_release (&frame_lock);
 
 	/* TODO: Insert page table entry to map page's VA to frame's PA. */
 	struct thread *cur = thread_current();
@@ -290,18 +1369,98 @@ page_less (const struct hash_elem *a_, const struct hash_elem *b_, void *aux UNU
 
 void hash_action (struct hash_elem *e, void *aux) {
 	struct page *page = hash_entry(e, struct page, elem);
-	if(page->is_loaded) {
-		vm_dealloc_page(page);
-	}
+	if (page->vma != NULL)
+		list_remove (&page->vma_elem);
+	vm_dealloc_page(page);
 }
 
 /* Initialize new supplemental page table */
 void
 supplemental_page_table_init (struct supplemental_page_table *spt UNUSED) {
 	hash_init(&spt->hash, page_hash, page_less, NULL);
+	vma_table_init (&spt->vmas);
+}
+
+/* Maps SRC's frame into the current thread's address space as a
+ * read-only copy-on-write page and inserts it into DST.  SRC loses
+ * write access too until one side writes.  Returns false with *SHARED
+ * unset if SRC is not resident, so the caller can copy it instead. */
+static bool
+vm_cow_share (struct supplemental_page_table *dst, struct page *src,
+		bool *shared) {
+	struct thread *cur = thread_current ();
+	struct page *page;
+	struct frame *frame;
+
+	*shared = false;
+	page = slab_alloc (&page_slab);
+	if (page == NULL)
+		return false;
+	memcpy (page, src, sizeof *page);
+	page->owner = cur;
+
+	lock_acquire (&frame_lock);
+	wait_eviction (src);
+	frame = src->frame;
+	if (frame == NULL) {
+		lock_release (&frame_lock);
+		slab_free (&page_slab, page);
+		return false;
+	}
+	if (!pml4_set_page (cur->pml4, page->va, frame->kva, false)) {
+		lock_release (&frame_lock);
+		slab_free (&page_slab, page);
+		return false;
+	}
+	pml4_set_writable (src->owner->pml4, src->va, false);
+	page->frame = NULL;
+	frame_link (frame, page);
+	lock_release (&frame_lock);
+
+	*shared = true;
+	if (!spt_insert_page (dst, page)) {
+		vm_free_frame (page);
+		slab_free (&page_slab, page);
+		return false;
+	}
+	return true;
+}
+
+/* Claims DST and fills it with the contents of SRC, which belongs to
+ * the parent.  Both frames stay pinned until the copy is done. */
+static bool
+vm_copy_page (struct page *dst, struct page *src) {
+	struct frame *src_frame, *frame;
+	bool succ;
+
+	lock_acquire (&frame_lock);
+	wait_eviction (src);
+	src_frame = src->frame;
+	if (src_frame != NULL)
+		src_frame->pin_cnt++;
+	lock_release (&frame_lock);
+
+	frame = vm_get_frame (false);
+	succ = frame != NULL && vm_load_frame (dst, frame);
+	if (succ) {
+		if (src_frame != NULL)
+			memcpy (frame->kva, src_frame->kva, PGSIZE);
+		else
+			succ = page_get_type (src) == VM_ANON
+				&& anon_swap_copy (src, frame->kva);
+	}
+	if (frame != NULL)
+		frame_unpin (frame);
+	if (src_frame != NULL)
+		frame_unpin (src_frame);
+	return succ;
 }
 
 /* Copy supplemental page table from src to dst */
+/* Resident anonymous pages are shared copy-on-write with the parent,
+ * so fork costs a page table entry per page instead of a frame and a
+ * memcpy.  Everything else is duplicated as before.  Pages never
+ * touched have no page object and come along with the regions. */
 bool
 supplemental_page_table_copy (struct supplemental_page_table *dst UNUSED,
 		struct supplemental_page_table *src UNUSED) {
@@ -310,23 +1469,84 @@ supplemental_page_table_copy (struct supplemental_page_table *dst UNUSED,
 	struct page *parent_page, *child_page;
 	bool status = false;
 	struct hash_iterator i;
+	uint64_t start = rdtsc ();
+
+	fork_cnt++;
+	if (!vma_table_copy (&dst->vmas, &src->vmas))
+		return false;
    	hash_first(&i, &src->hash);
    	while (e = hash_next(&i)) {
 		parent_page = hash_entry(e, struct page, elem); // 부모 페이지를 src_hash에서 가져오기
-		status = vm_alloc_page_with_initializer(page_get_type(parent_page), parent_page->va, parent_page->writable, parent_page->uninit.init, parent_page->uninit.aux);
-		if(!status) {
-			return status;
+
+		if (page_get_type (parent_page) == VM_ANON
+				&& parent_page->frame != NULL
+				&& VM_TYPE (parent_page->operations->type) != VM_UNINIT) {
+			bool shared;
+			if (vm_cow_share (dst, parent_page, &shared)) {
+				fork_shared++;
+				continue;
+			}
+			if (shared)
+				return false;
 		}
-		child_page = spt_find_page(dst, parent_page->va);
 
-		if(parent_page->frame != NULL) {
-			status = vm_do_claim_page(child_page);
-			if(!status) {
+		/* Pages that were never touched are copied as pending pages with
+		 * their own copy of the segment they load from. */
+		if (VM_TYPE (parent_page->operations->type) == VM_UNINIT) {
+			struct segment *aux = NULL;
+			if (parent_page->uninit.aux != NULL) {
+				aux = segment_duplicate (parent_page->uninit.aux);
+				if (aux == NULL)
+					return false;
+			}
+			status = vm_alloc_page_with_initializer (parent_page->uninit.type,
+					parent_page->va, parent_page->writable,
+					parent_page->uninit.init, aux);
+			if (!status) {
+				segment_free (aux);
 				return status;
 			}
-			memcpy(child_page->frame->kva, parent_page->frame->kva, PGSIZE);
+			continue;
+		}
+
+		/* File pages read back from their file; only modified contents
+		 * are copied.  Text is picked up from the cache on first use. */
+		if (page_get_type (parent_page) == VM_FILE) {
+			child_page = slab_alloc (&page_slab);
+			if (child_page == NULL)
+				return false;
+			memcpy (child_page, parent_page, sizeof *child_page);
+			child_page->owner = thread_current ();
+			child_page->frame = NULL;
+			child_page->is_loaded = false;
+			child_page->file.inode = inode_reopen (parent_page->file.inode);
+			if (!spt_insert_page (dst, child_page)) {
+				vm_dealloc_page (child_page);
+				return false;
+			}
+			if (parent_page->writable && parent_page->frame != NULL) {
+				if (!vm_copy_page (child_page, parent_page))
+					return false;
+				fork_copied++;
+			}
+			continue;
 		}
+
+		/* Once an anonymous page is initialized its uninit fields are
+		 * gone, so the child gets a blank page and the contents below.
+		 * A page still mapping the zero frame needs no contents. */
+		status = vm_alloc_page (VM_ANON, parent_page->va, parent_page->writable);
+		if(!status) {
+			return status;
+		}
+		if (page_maps_zero (parent_page))
+			continue;
+		child_page = spt_find_page(dst, parent_page->va);
+		if (!vm_copy_page (child_page, parent_page))
+			return false;
+		fork_copied++;
 	}
+	fork_cycles += rdtsc () - start;
 	return true;
 }
 
@@ -336,4 +1556,5 @@ supplemental_page_table_kill (struct supplemental_page_table *spt UNUSED) {
 	/* TODO: Destroy all the supplemental_page_table hold by thread and
 	 * TODO: writeback all the modified contents to the storage. */
 	hash_destroy(&spt->hash, hash_action);
+	vma_table_destroy (&spt->vmas);
 }
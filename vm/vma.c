@@ -0,0 +1,193 @@
+/* vma.c: Ranges of a process's address space.
+ *
+ * The supplemental page table only holds pages that have been touched.
+ * Everything else a process may access is described here by a few
+ * regions, kept in an array sorted by address and searched by
+ * bisection, so that setting up or tearing down a region costs the
+ * same however many pages it spans. */
+
+#include "vm/vm.h"
+#include <string.h>
+#include "filesys/file.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/slab.h"
+#include "threads/vaddr.h"
+
+/* Region objects. */
+static struct slab_cache vma_slab;
+
+/* Initializes the region allocator. */
+void
+vma_init (void) {
+	slab_cache_init (&vma_slab, "vma", sizeof (struct vma));
+}
+
+/* Initializes TABLE to hold no regions. */
+void
+vma_table_init (struct vma_table *table) {
+	table->vmas = NULL;
+	table->cnt = 0;
+	table->cap = 0;
+}
+
+/* Returns the index of the first region of TABLE that ends after VA,
+ * which is the region holding VA if there is one. */
+static size_t
+vma_bisect (const struct vma_table *table, const void *va) {
+	size_t lo = 0, hi = table->cnt;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if ((const uint8_t *) table->vmas[mid]->end <= (const uint8_t *) va)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* Returns the region of TABLE holding VA, or NULL. */
+struct vma *
+vma_find (const struct vma_table *table, const void *va) {
+	size_t i = vma_bisect (table, va);
+
+	if (i < table->cnt
+			&& (const uint8_t *) table->vmas[i]->start <= (const uint8_t *) va)
+		return table->vmas[i];
+	return NULL;
+}
+
+/* Returns true if any region of TABLE overlaps [START, END). */
+bool
+vma_overlaps (const struct vma_table *table, const void *start,
+		const void *end) {
+	size_t i = vma_bisect (table, start);
+
+	return i < table->cnt
+		&& (const uint8_t *) table->vmas[i]->start < (const uint8_t *) end;
+}
+
+/* Creates a region of PAGE_CNT pages at START whose pages are of TYPE
+ * and loaded by INIT.  The first READ_BYTES bytes come from INODE
+ * starting at OFS, and the rest are zeros.  The region holds its own
+ * reference to INODE, which may be null if READ_BYTES is 0.  Returns
+ * NULL if memory is short. */
+struct vma *
+vma_create (void *start, size_t page_cnt, enum vm_type type, bool writable,
+		vm_initializer *init, struct inode *inode, off_t ofs,
+		off_t read_bytes) {
+	struct vma *vma = slab_alloc (&vma_slab);
+
+	ASSERT (pg_ofs (start) == 0);
+	ASSERT (inode != NULL || read_bytes == 0);
+
+	if (vma == NULL)
+		return NULL;
+	vma->start = start;
+	vma->end = (uint8_t *) start + page_cnt * PGSIZE;
+	vma->type = type;
+	vma->writable = writable;
+	vma->init = init;
+	vma->inode = inode_reopen (inode);
+	vma->ofs = ofs;
+	vma->read_bytes = read_bytes;
+	vma->file = NULL;
+	list_init (&vma->pages);
+	return vma;
+}
+
+/* Frees VMA and the references it holds.  Its pages must be gone. */
+void
+vma_destroy (struct vma *vma) {
+	ASSERT (list_empty (&vma->pages));
+
+	file_close (vma->file);
+	inode_close (vma->inode);
+	slab_free (&vma_slab, vma);
+}
+
+/* Adds VMA to TABLE.  Returns false if it overlaps a region already
+ * there or memory is short. */
+bool
+vma_insert (struct vma_table *table, struct vma *vma) {
+	size_t i = vma_bisect (table, vma->start);
+
+	if (i < table->cnt && table->vmas[i]->start < vma->end)
+		return false;
+	if (table->cnt == table->cap) {
+		size_t cap = table->cap != 0 ? table->cap * 2 : 8;
+		struct vma **vmas = realloc (table->vmas, cap * sizeof *vmas);
+		if (vmas == NULL)
+			return false;
+		table->vmas = vmas;
+		table->cap = cap;
+	}
+	memmove (table->vmas + i + 1, table->vmas + i,
+			(table->cnt - i) * sizeof *table->vmas);
+	table->vmas[i] = vma;
+	table->cnt++;
+	return true;
+}
+
+/* Takes VMA out of TABLE without freeing it. */
+void
+vma_remove (struct vma_table *table, struct vma *vma) {
+	size_t i = vma_bisect (table, vma->start);
+
+	ASSERT (i < table->cnt && table->vmas[i] == vma);
+	table->cnt--;
+	memmove (table->vmas + i, table->vmas + i + 1,
+			(table->cnt - i) * sizeof *table->vmas);
+}
+
+/* Extends the zero-filled region VMA of TABLE down to START, which is
+ * how the stack grows.  Returns false if that would run into the
+ * region below. */
+bool
+vma_grow_down (struct vma_table *table, struct vma *vma, void *start) {
+	size_t i = vma_bisect (table, vma->start);
+
+	ASSERT (pg_ofs (start) == 0);
+	ASSERT (vma->inode == NULL);
+
+	if (start >= vma->start)
+		return true;
+	if (i > 0 && table->vmas[i - 1]->end > start)
+		return false;
+	vma->start = start;
+	return true;
+}
+
+/* Gives DST, which must be empty, a copy of every region in SRC with
+ * references of its own.  The pages are not copied. */
+bool
+vma_table_copy (struct vma_table *dst, const struct vma_table *src) {
+	for (size_t i = 0; i < src->cnt; i++) {
+		const struct vma *vma = src->vmas[i];
+		struct vma *copy = vma_create (vma->start,
+				((uint8_t *) vma->end - (uint8_t *) vma->start) / PGSIZE,
+				vma->type, vma->writable, vma->init, vma->inode, vma->ofs,
+				vma->read_bytes);
+		if (copy == NULL)
+			return false;
+		if (vma->file != NULL)
+			copy->file = file_reopen (vma->file);
+		if ((vma->file != NULL && copy->file == NULL)
+				|| !vma_insert (dst, copy)) {
+			vma_destroy (copy);
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Frees every region of TABLE, leaving it empty.  Their pages must be
+ * gone. */
+void
+vma_table_destroy (struct vma_table *table) {
+	for (size_t i = 0; i < table->cnt; i++)
+		vma_destroy (table->vmas[i]);
+	free (table->vmas);
+	vma_table_init (table);
+}